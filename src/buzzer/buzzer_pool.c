@@ -186,9 +186,10 @@ int buzzer_pool_close(BuzzerPool *this)
 	return 0;
 }
 
-void buzzer_pool_wait(BuzzerPool *this, useconds_t usec)
+int buzzer_pool_wait(BuzzerPool *this, useconds_t usec)
 {
 	usleep(usec);
+	return 0;
 }
 
 void buzzer_pool_info(BuzzerPool *this)
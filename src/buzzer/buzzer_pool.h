@@ -45,7 +45,7 @@ int buzzer_pool_set_note(BuzzerPool *this, int channel, int note, int velocity,
 void buzzer_pool_debug(BuzzerPool *this);
 int buzzer_pool_open(BuzzerPool *this);
 int buzzer_pool_close(BuzzerPool *this);
-void buzzer_pool_wait(BuzzerPool *this, useconds_t usec);
+int buzzer_pool_wait(BuzzerPool *this, useconds_t usec);
 
 #endif
 
@@ -0,0 +1,162 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eventbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define EVENTBUF_MIN_CAPACITY 1024
+
+Eventbuf *eventbuf_new(void)
+{
+	Eventbuf *this = malloc(sizeof(Eventbuf));
+	if (this == NULL) {
+		return NULL;
+	}
+
+	this->events = NULL;
+	this->count = 0;
+	this->capacity = 0;
+	return this;
+}
+
+void eventbuf_free(Eventbuf *this)
+{
+	free(this->events);
+	free(this);
+}
+
+void eventbuf_clear(Eventbuf *this)
+{
+	this->count = 0;
+}
+
+int eventbuf_reserve(Eventbuf *this, size_t capacity)
+{
+	if (capacity <= this->capacity) {
+		return 0;
+	}
+
+	Event *events = realloc(this->events, capacity * sizeof(Event));
+	if (events == NULL) {
+		return -1;
+	}
+	this->events = events;
+	this->capacity = capacity;
+	return 0;
+}
+
+Event *eventbuf_append(Eventbuf *this)
+{
+	if (this->count >= this->capacity) {
+		size_t capacity = this->capacity * 2;
+		if (capacity < EVENTBUF_MIN_CAPACITY) {
+			capacity = EVENTBUF_MIN_CAPACITY;
+		}
+		if (eventbuf_reserve(this, capacity) != 0) {
+			return NULL;
+		}
+	}
+	return &this->events[this->count++];
+}
+
+int event_cmp_tick(Event const *a, Event const *b)
+{
+	if (a->tick == b->tick) {
+		if (a->state == b->state) {
+			return 0;
+		}
+		return a->state ? 1 : -1;
+	}
+	return a->tick > b->tick ? 1 : -1;
+}
+
+static size_t eventbuf_run_end(Event const *events, size_t from, size_t count)
+{
+	size_t i = from + 1;
+	while (i < count && event_cmp_tick(&events[i - 1], &events[i]) <= 0) {
+		i++;
+	}
+	return i;
+}
+
+static void eventbuf_merge(Event const *src, size_t from, size_t mid, size_t to, Event *dst)
+{
+	size_t i = from;
+	size_t j = mid;
+	size_t k = from;
+
+	while (i < mid && j < to) {
+		//Take from the left run on ties to keep the sort stable
+		if (event_cmp_tick(&src[j], &src[i]) < 0) {
+			dst[k++] = src[j++];
+		}
+		else {
+			dst[k++] = src[i++];
+		}
+	}
+	while (i < mid) {
+		dst[k++] = src[i++];
+	}
+	while (j < to) {
+		dst[k++] = src[j++];
+	}
+}
+
+//Stable natural merge sort: each pass merges adjacent ascending runs
+//pairwise, so already tick-ordered events are sorted in a single scan
+//and the worst case is O(n log n) without any recursion.
+int eventbuf_sort(Eventbuf *this)
+{
+	size_t count = this->count;
+	if (count < 2 || eventbuf_run_end(this->events, 0, count) == count) {
+		return 0;
+	}
+
+	Event *scratch = malloc(count * sizeof(Event));
+	if (scratch == NULL) {
+		return -1;
+	}
+
+	Event *src = this->events;
+	Event *dst = scratch;
+	int runs;
+	do {
+		runs = 0;
+		size_t from = 0;
+		while (from < count) {
+			size_t mid = eventbuf_run_end(src, from, count);
+			size_t to = mid < count ? eventbuf_run_end(src, mid, count) : count;
+			eventbuf_merge(src, from, mid, to, dst);
+			from = to;
+			runs++;
+		}
+
+		Event *tmp = src;
+		src = dst;
+		dst = tmp;
+	} while (runs > 1);
+
+	if (src != this->events) {
+		memcpy(this->events, src, count * sizeof(Event));
+	}
+	free(scratch);
+	return 0;
+}
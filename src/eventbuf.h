@@ -0,0 +1,56 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENTBUF_H
+#define EVENTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct event {
+	int64_t time;  //microseconds, set from the tempo map
+	uint32_t tick;
+	uint8_t channel;
+	uint8_t note;
+	uint8_t velocity;
+	bool state;
+};
+
+typedef struct event Event;
+
+struct eventbuf {
+	Event *events;
+	size_t count;
+	size_t capacity;
+};
+
+typedef struct eventbuf Eventbuf;
+
+Eventbuf *eventbuf_new(void);
+void eventbuf_free(Eventbuf *this);
+void eventbuf_clear(Eventbuf *this);
+int eventbuf_reserve(Eventbuf *this, size_t capacity);
+Event *eventbuf_append(Eventbuf *this);
+int eventbuf_sort(Eventbuf *this);
+
+int event_cmp_tick(Event const *a, Event const *b);
+
+#define EVENTBUF_FOREACH(buf, event) \
+	for (event = (buf)->events; event < (buf)->events + (buf)->count; event++)
+
+#endif
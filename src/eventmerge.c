@@ -0,0 +1,109 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eventmerge.h"
+
+#include <stdlib.h>
+
+#include "common.h"
+
+static int eventmerge_cmp(struct eventmerge_cursor const *a, struct eventmerge_cursor const *b)
+{
+	int cmp = event_cmp_tick(a->event, b->event);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return a->run - b->run;
+}
+
+static void eventmerge_sift_down(Eventmerge *this, int i)
+{
+	struct eventmerge_cursor *heap = this->heap;
+	for (;;) {
+		int min = i;
+		int left = 2 * i + 1;
+		int right = left + 1;
+
+		if (left < this->count && eventmerge_cmp(&heap[left], &heap[min]) < 0) {
+			min = left;
+		}
+		if (right < this->count && eventmerge_cmp(&heap[right], &heap[min]) < 0) {
+			min = right;
+		}
+		if (min == i) {
+			return;
+		}
+
+		struct eventmerge_cursor tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+Eventmerge *eventmerge_new(Eventbuf **runs, int nruns)
+{
+	Eventmerge *this = malloc(sizeof(Eventmerge));
+	if (this == NULL) {
+		return NULL;
+	}
+
+	this->heap = malloc(nruns * sizeof(struct eventmerge_cursor));
+	if (this->heap == NULL && nruns > 0) {
+		free(this);
+		return NULL;
+	}
+
+	this->count = 0;
+	for (int i = 0; i < nruns; i++) {
+		if (runs[i]->count == 0) {
+			continue;
+		}
+		struct eventmerge_cursor *cursor = &this->heap[this->count++];
+		cursor->event = runs[i]->events;
+		cursor->end = runs[i]->events + runs[i]->count;
+		cursor->run = i;
+	}
+
+	for (int i = this->count / 2 - 1; i >= 0; i--) {
+		eventmerge_sift_down(this, i);
+	}
+	return this;
+}
+
+void eventmerge_free(Eventmerge *this)
+{
+	free(this->heap);
+	free(this);
+}
+
+Event const *eventmerge_next(Eventmerge *this)
+{
+	if (this->count == 0) {
+		return NULL;
+	}
+
+	struct eventmerge_cursor *top = &this->heap[0];
+	Event const *event = top->event++;
+
+	if (top->event == top->end) {
+		this->count--;
+		this->heap[0] = this->heap[this->count];
+	}
+	eventmerge_sift_down(this, 0);
+	return event;
+}
@@ -15,13 +15,28 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef LIST_QSORT_H
-#define LIST_QSORT_H
+#ifndef EVENTMERGE_H
+#define EVENTMERGE_H
 
-#include "list.h"
+#include "eventbuf.h"
 
-typedef int (*ListCmpCB)(ListItem *a, ListItem *b);
+struct eventmerge_cursor {
+	Event const *event;
+	Event const *end;
+	int run;
+};
 
-void list_qsort(List *list, ListCmpCB cmp);
+//K-way merge of sorted event runs, events are pulled one by one in
+//tick order. Ties are returned in run order.
+struct eventmerge {
+	struct eventmerge_cursor *heap;
+	int count;
+};
+
+typedef struct eventmerge Eventmerge;
+
+Eventmerge *eventmerge_new(Eventbuf **runs, int nruns);
+void eventmerge_free(Eventmerge *this);
+Event const *eventmerge_next(Eventmerge *this);
 
 #endif
@@ -21,9 +21,9 @@
 #include <stdlib.h>
 
 #include "common.h"
-#include "streambuf.h"
+#include "threadpool.h"
 
-Midiparser *midiparser_new(void)
+Midiparser *midiparser_new(int jobs)
 {
 	Midiparser *this = malloc(sizeof(Midiparser));
 	if (this == NULL) {
@@ -32,13 +32,16 @@ Midiparser *midiparser_new(void)
 	this->format = 0;
 	this->ntrks = 0;
 	this->division = 0xf0;
-	this->tempo = 697674;
-	this->last_evt = 0;
+	this->jobs = jobs;
+	this->tracks = NULL;
+	this->buf = NULL;
+	this->player = NULL;
 	return this;
 }
 
 void midiparser_free(Midiparser *this)
 {
+	midiparser_close(this);
 	free(this);
 }
 
@@ -49,24 +52,6 @@ void midiparser_dump(Midiparser *this)
 	printf("format: 0x%x\n", this->format);
 	printf("ntrks: 0x%x\n", this->ntrks);
 	printf("division: 0x%x\n", this->division);
-	printf("tempo: %d\n", this->tempo);
-}
-
-int midiparser_ticks_to_ms(Midiparser *this, int ticks)
-{
-	if (this->division & 0x10000) {
-/*
-		int negative_smpte_format = (this->division & 0xff00) >> 8;
-		int ticks_per_frame = (this->division & 0x00ff);
-*/
-		print_error("not implemented division");
-		return -1;
-	}
-	else {
-		int ticks_per_quarter_note = this->division & 0xffff;
-		return (long) ticks * (long) this->tempo / (long) ticks_per_quarter_note;
-	}
-	return -1;
 }
 
 int midiparser_parse_header(Midiparser *this, Streambuf *buf)
@@ -116,7 +101,7 @@ int midiparser_parse_header(Midiparser *this, Streambuf *buf)
 	return 0;
 }
 
-int midiparser_parse_event_time_signature(Midiparser *this, uint8_t *data, uint8_t length)
+int midiparser_parse_event_time_signature(MidiparserTrack *this, uint8_t const *data, uint32_t length)
 {
 	//FF 58 04 nn dd cc bb Time Signature
 	if (length != 4) {
@@ -134,7 +119,7 @@ int midiparser_parse_event_time_signature(Midiparser *this, uint8_t *data, uint8
 	return 0;
 }
 
-int midiparser_parse_event_key_signature(Midiparser *this, uint8_t *data, uint8_t length)
+int midiparser_parse_event_key_signature(MidiparserTrack *this, uint8_t const *data, uint32_t length)
 {
 	//FF 59 02 sf mi
 	if (length != 2) {
@@ -150,7 +135,7 @@ int midiparser_parse_event_key_signature(Midiparser *this, uint8_t *data, uint8_
 	return 0;
 }
 
-int midiparser_parse_event_set_tempo(Midiparser *this, uint8_t *data, uint8_t length)
+int midiparser_parse_event_set_tempo(MidiparserTrack *this, uint8_t const *data, uint32_t length)
 {
 	//FF 51 03 tttttt
 	if (length != 3) {
@@ -158,11 +143,11 @@ int midiparser_parse_event_set_tempo(Midiparser *this, uint8_t *data, uint8_t le
 		return -1;
 	}
 
-	this->tempo = (data[0] << 16) | (data[1] << 8) | (data[2] << 0);
-	return 0;
+	uint32_t tempo = (data[0] << 16) | (data[1] << 8) | (data[2] << 0);
+	return player_set_tempo(this->player, this->index, this->tick, tempo);
 }
 
-int midiparser_parser_smpte_offset(Midiparser *this, uint8_t *data, uint8_t length)
+int midiparser_parser_smpte_offset(MidiparserTrack *this, uint8_t const *data, uint32_t length)
 {
 	//FF 54 05 hr mn se fr ff SMPTE Offset
 	if (length != 5) {
@@ -181,7 +166,7 @@ int midiparser_parser_smpte_offset(Midiparser *this, uint8_t *data, uint8_t leng
 	return 0;
 }
 
-int midiparser_parser_channel_prefix(Midiparser *this, uint8_t *data, uint8_t length)
+int midiparser_parser_channel_prefix(MidiparserTrack *this, uint8_t const *data, uint32_t length)
 {
 	//FF 20 01 cc MIDI Channel Prefix
 	if (length != 1) {
@@ -196,64 +181,54 @@ int midiparser_parser_channel_prefix(Midiparser *this, uint8_t *data, uint8_t le
 	return 0;
 }
 
-inline static int midiparser_parse_message_arg(Streambuf *buf, uint8_t *value)
+//Read message data bytes with a single bounds check
+inline static int midiparser_parse_message_args(Streambuf *buf, uint8_t *args, int count)
 {
-	uint8_t v;
-	if (streambuf_read_u8(buf, &v) != 0) {
+	if (streambuf_available(buf) < count) {
 		return -1;
 	}
-	if ((v & 0x80) != 0) {
-		print_error("Unexpected message argument: 0x%x", v);
-		return -1;
+
+	uint8_t const *p = streambuf_cursor(buf);
+	for (int i = 0; i < count; i++) {
+		if ((p[i] & 0x80) != 0) {
+			print_error("Unexpected message argument: 0x%x", p[i]);
+			return -1;
+		}
+		args[i] = p[i];
 	}
-	*value = v;
+	buf->read_offset += count;
 	return 0;
 }
 
-int midiparser_parse_variable_length_quantity(Midiparser *this, Streambuf *buf, uint32_t *value)
+inline static int midiparser_channel_message_length(uint8_t status)
 {
-	*value = 0;
-	uint8_t u8;
-	for (int i = 0; i < 4; i++) {
-		if (streambuf_read_u8(buf, &u8) != 0) {
-			return -1;
-		}
-		*value = (*value << 7) | (u8 & 0x7f);
-
-		if ((u8 & 0x80) == 0) {
-			return 0;
-		}
-	}
-	return -1;
+	//Program Change and Channel Pressure have a single data byte
+	uint8_t code = status & 0xf0;
+	return (code == 0xc0 || code == 0xd0) ? 1 : 2;
 }
 
-int midiparser_parse_meta_event(Midiparser *this, Streambuf *buf)
+int midiparser_parse_meta_event(MidiparserTrack *this)
 {
+	Streambuf *buf = &this->buf;
+
 	uint8_t code;
 	if (streambuf_read_u8(buf, &code) != 0) {
 		return -1;
 	}
 
 	uint32_t length;
-	if (midiparser_parse_variable_length_quantity(this, buf, &length) != 0) {
+	if (streambuf_read_vlq(buf, &length) != 0) {
 		return -1;
 	}
 
-	int ret = 0;
-	uint8_t *data = malloc(length);
-	if (data == NULL) {
+	uint8_t const *data;
+	if (streambuf_read_view(buf, length, &data) != 0) {
 		return -1;
 	}
 
-	for (int i = 0; i < length; i++) {
-		if (streambuf_read_u8(buf, &data[i]) != 0) {
-			ret = -1;
-			goto exit;
-		}
-	}
-
 	DMSG("[ meta event ] code: 0x%x, length: %d", code, length);
 
+	int ret = 0;
 	switch (code) {
 	case 0x01:
 		DMSG("[Text Event]");
@@ -309,38 +284,44 @@ int midiparser_parse_meta_event(Midiparser *this, Streambuf *buf)
 		ret = -1;
 		break;
 	}
-exit:
-	free(data);
 	return ret;
 }
 
 
-int midiparser_parse_system_exclusive_message(Midiparser *this, Streambuf *buf)
+int midiparser_parse_system_exclusive_message(MidiparserTrack *this)
 {
+	Streambuf *buf = &this->buf;
+
 	uint32_t length;
-	if (midiparser_parse_variable_length_quantity(this, buf, &length) != 0) {
+	if (streambuf_read_vlq(buf, &length) != 0) {
 		return -1;
 	}
 
 	DMSG("[ System exclusive ] length: %d", length);
 
-	uint8_t v;
+#ifdef DEBUG
+	uint8_t const *data;
+	if (streambuf_read_view(buf, length, &data) != 0) {
+		return -1;
+	}
 	for (int i = 0; i < length; i++) {
-		if (streambuf_read_u8(buf, &v) != 0) {
-			return -1;
-		}
-		DMSG("0x%x", v);
+		DMSG("0x%x", data[i]);
 	}
 	return 0;
+#else
+	return streambuf_skip(buf, length);
+#endif
 }
 
-int midiparser_parse_system_common_message(Midiparser *this, Streambuf *buf, uint8_t status)
+int midiparser_parse_system_common_message(MidiparserTrack *this, uint8_t status)
 {
+	Streambuf *buf = &this->buf;
+
 	DMSG("system common message: 0x%x", status);
 
 	switch (status) {
 	case 0xf0:
-		return midiparser_parse_system_exclusive_message(this, buf);
+		return midiparser_parse_system_exclusive_message(this);
 
 	case 0xf1:
 		//undefined
@@ -348,32 +329,28 @@ int midiparser_parse_system_common_message(Midiparser *this, Streambuf *buf, uin
 
 	case 0xf2: {
 		//Song Position Pointer
-		uint8_t l;
-		if (midiparser_parse_message_arg(buf, &l) != 0) {
+		uint8_t args[2];
+		if (midiparser_parse_message_args(buf, args, 2) != 0) {
 			return -1;
 		}
-		uint8_t m;
-		if (midiparser_parse_message_arg(buf, &m) != 0) {
-			return -1;
-		}
-		DMSG("[ Song position pointer ] l: %d, m: %d", l, m);
+		DMSG("[ Song position pointer ] l: %d, m: %d", args[0], args[1]);
 		break;
 	}
 	case 0xf3: {
 		//Song Select
-		uint8_t s;
-		if (midiparser_parse_message_arg(buf, &s) != 0) {
+		uint8_t args[1];
+		if (midiparser_parse_message_args(buf, args, 1) != 0) {
 			return -1;
 		}
-		DMSG("[ Song select ] s: %d", s);
+		DMSG("[ Song select ] s: %d", args[0]);
 		break;
 	}
 	case 0xf7:
-		return midiparser_parse_system_exclusive_message(this, buf);
+		return midiparser_parse_system_exclusive_message(this);
 
 	case 0xff:
 		//Meta event
-		return midiparser_parse_meta_event(this, buf);
+		return midiparser_parse_meta_event(this);
 
 	default:
 		print_error("Not implemented system common message: 0x%x", status);
@@ -382,7 +359,7 @@ int midiparser_parse_system_common_message(Midiparser *this, Streambuf *buf, uin
 	return 0;
 }
 
-int midiparser_parse_channel_message(Midiparser *this, Player *player, Streambuf *buf, uint8_t status, uint8_t arg1)
+int midiparser_parse_channel_message(MidiparserTrack *this, uint8_t status, uint8_t const *args)
 {
 	int code = (status & 0xf0) >> 4;
 	int channel = status & 0x0f;
@@ -390,77 +367,39 @@ int midiparser_parse_channel_message(Midiparser *this, Player *player, Streambuf
 
 	switch (code) {
 	//1000nnnn 0kkkkkkk 0vvvvvvv: note OFF
-	case 0x8: {
-		uint8_t k = arg1;
-		uint8_t v;
-		if (midiparser_parse_message_arg(buf, &v) != 0) {
-			return -1;
-		}
-
-		DMSG("note OFF: k:%d v:%d", k, v);
-		player_set_note(player, channel, k, v, false);
-
-		return 0;
-	}
+	case 0x8:
+		DMSG("note OFF: k:%d v:%d", args[0], args[1]);
+		return player_set_note(this->player, this->index, this->tick, channel, args[0], args[1], false);
 
 	//1001nnnn 0kkkkkkk 0vvvvvvv: note ON
-	case 0x9: {
-		uint8_t k = arg1;
-		uint8_t v;
-		if (midiparser_parse_message_arg(buf, &v) != 0) {
-			return -1;
-		}
-
-		DMSG("note ON: k:%d v:%d", k, v);
-		player_set_note(player, channel, k, v, v != 0);
-
-		return 0;
-	}
+	case 0x9:
+		DMSG("note ON: k:%d v:%d", args[0], args[1]);
+		return player_set_note(this->player, this->index, this->tick, channel, args[0], args[1], args[1] != 0);
 
 	//1001nnnn 0kkkkkkk 0vvvvvvv
-	case 0xa: {
-		uint8_t v;
-		if (midiparser_parse_message_arg(buf, &v) != 0) {
-			return -1;
-		}
-
-		DMSG("Polyphonic Key Pressure: k:%d v:%d", arg1, v);
+	case 0xa:
+		DMSG("Polyphonic Key Pressure: k:%d v:%d", args[0], args[1]);
 		return 0;
-	}
 
 	//1011nnnn 0ccccccc 0vvvvvvv
-	case 0xb: {
-		uint8_t v;
-		if (midiparser_parse_message_arg(buf, &v) != 0) {
-			return -1;
-		}
-
-		DMSG("Control Change: c:%d v:%d", arg1, v);
+	case 0xb:
+		DMSG("Control Change: c:%d v:%d", args[0], args[1]);
 		return 0;
-	}
 
 	//1100nnnn 0ppppppp
-	case 0xc: {
-		DMSG("Program Change: p:%d", arg1);
+	case 0xc:
+		DMSG("Program Change: p:%d", args[0]);
 		return 0;
-	}
 
 	//1101nnnn 0vvvvvvv
-	case 0xd: {
-		DMSG("Channel pressure: p:%d", arg1);
+	case 0xd:
+		DMSG("Channel pressure: p:%d", args[0]);
 		return 0;
-	}
 
 	//1110nnnn 0lllllll 0mmmmmmm
-	case 0xe: {
-		uint8_t m;
-		if (midiparser_parse_message_arg(buf, &m) != 0) {
-			return -1;
-		}
-
-		DMSG("Pitch Wheel Change: l:%d m:%d", arg1, m);
+	case 0xe:
+		DMSG("Pitch Wheel Change: l:%d m:%d", args[0], args[1]);
 		return 0;
-	}
 
 	default:
 		print_error("Not implemented channel message: 0x%x", code);
@@ -474,21 +413,18 @@ bool midiparser_is_channel_message(uint8_t status)
 	return ((status & 0x80) != 0 && (status & 0xf0) != 0xf0);
 }
 
-int midiparser_parse_event(Midiparser *this, Player *player, Streambuf *buf)
+int midiparser_parse_event(MidiparserTrack *this)
 {
+	Streambuf *buf = &this->buf;
 	DMSG("[ Event ]");
 
 	uint32_t delta_time;
-	if (midiparser_parse_variable_length_quantity(this, buf, &delta_time) != 0) {
+	if (streambuf_read_vlq(buf, &delta_time) != 0) {
 		return -1;
 	}
 	DMSG("delta-time: 0x%x", delta_time);
 
-	int ms = midiparser_ticks_to_ms(this, delta_time);
-	if (ms < 0) {
-		return -1;
-	}
-	player_time_forward(player, ms);
+	this->tick += delta_time;
 
 	uint8_t evt;
 	if (streambuf_read_u8(buf, &evt) != 0) {
@@ -506,51 +442,42 @@ int midiparser_parse_event(Midiparser *this, Player *player, Streambuf *buf)
 			return -1;
 		}
 		DMSG("repeat last evt: 0x%x", this->last_evt);
-		return midiparser_parse_channel_message(this, player, buf, this->last_evt, evt);
+
+		//The status byte is omitted, evt is the first data byte
+		uint8_t args[2] = { evt, 0 };
+		int length = midiparser_channel_message_length(this->last_evt);
+		if (midiparser_parse_message_args(buf, args + 1, length - 1) != 0) {
+			return -1;
+		}
+		return midiparser_parse_channel_message(this, this->last_evt, args);
 	}
 	else {
 		this->last_evt = evt;
 
 		//Channel message
 		if (midiparser_is_channel_message(evt) == true) {
-			uint8_t arg1;
-			if (midiparser_parse_message_arg(buf, &arg1) != 0) {
+			uint8_t args[2] = { 0, 0 };
+			if (midiparser_parse_message_args(buf, args, midiparser_channel_message_length(evt)) != 0) {
 				return -1;
 			}
 
-			return midiparser_parse_channel_message(this, player, buf, evt, arg1);
+			return midiparser_parse_channel_message(this, evt, args);
 		}
 
 		//System common message
 		else { 
-			return midiparser_parse_system_common_message(this, buf, evt);
+			return midiparser_parse_system_common_message(this, evt);
 		}
 	}
 	return -1;
 }
 
-int midiparser_parse_track(Midiparser *this, Player *player, Streambuf *buf)
+int midiparser_parse_track(MidiparserTrack *this)
 {
 	DMSG("[ Track ]");
 
-	//Read magic
-	uint32_t magic;
-	if (streambuf_read_u32(buf, &magic) != 0) {
-		return -1;
-	}
-	if (magic != MIDIFILE_MAGIC_MTRK) { //MTrk
-		print_error("Unexpected magic value");
-		return -1;
-	}
-
-	uint32_t length;
-	if (streambuf_read_u32(buf, &length) != 0) {
-		return -1;
-	}
-	DMSG("length: 0x%x", length);
-	size_t from_offset = buf->read_offset;
 	for (;;) {
-		int ret = midiparser_parse_event(this, player, buf);
+		int ret = midiparser_parse_event(this);
 		if (ret < 0) {
 			print_error("Could not parse midi event");
 			return -1;
@@ -559,24 +486,131 @@ int midiparser_parse_track(Midiparser *this, Player *player, Streambuf *buf)
 			break;
 		}
 	}
-	if (length != buf->read_offset - from_offset) {
+	if (streambuf_available(&this->buf) != 0) {
 		print_error("Unexpected end of track");
 		return -1;
 	}
 	return 0;
 }
 
-int midiparser_parse(Midiparser *this, Player *player, Streambuf *buf)
+static void midiparser_parse_track_task(MidiparserTrack *tracks, int index)
+{
+	tracks[index].ret = midiparser_parse_track(&tracks[index]);
+}
+
+//Locate the MTrk chunks from their header, so that tracks can be
+//parsed independently
+int midiparser_scan_tracks(Midiparser *this, Streambuf *buf)
 {
-	if (midiparser_parse_header(this, buf) != 0) {
+	this->tracks = calloc(this->ntrks, sizeof(MidiparserTrack));
+	if (this->tracks == NULL && this->ntrks > 0) {
 		return -1;
 	}
 
 	for (int i = 0; i < this->ntrks; i++) {
-		if (this->format != 2) {
-			player_time_reset(player);
+		//Read magic
+		uint32_t magic;
+		if (streambuf_read_u32(buf, &magic) != 0) {
+			return -1;
+		}
+		if (magic != MIDIFILE_MAGIC_MTRK) { //MTrk
+			print_error("Unexpected magic value");
+			return -1;
+		}
+
+		uint32_t length;
+		if (streambuf_read_u32(buf, &length) != 0) {
+			return -1;
+		}
+		DMSG("track #%d length: 0x%x", i + 1, length);
+
+		MidiparserTrack *track = &this->tracks[i];
+		if (streambuf_read_view(buf, length, &track->buf.data) != 0) {
+			print_error("Unexpected end of file");
+			return -1;
+		}
+		track->buf.size = length;
+		track->buf.read_offset = 0;
+		track->buf.mapped = false;
+
+		track->player = this->player;
+		track->index = -1;
+		track->tick = 0;
+		track->last_evt = 0;
+		track->ret = 0;
+	}
+	return 0;
+}
+
+//Read the header and locate the tracks, events are parsed afterwards
+int midiparser_open(Midiparser *this, Player *player, char const *filename)
+{
+	this->buf = streambuf_new();
+	if (this->buf == NULL) {
+		return -1;
+	}
+
+	if (streambuf_open(this->buf, filename) != 0) {
+		return -1;
+	}
+
+	if (midiparser_parse_header(this, this->buf) != 0) {
+		return -1;
+	}
+	this->player = player;
+	player_set_division(player, this->division);
+
+	return midiparser_scan_tracks(this, this->buf);
+}
+
+void midiparser_close(Midiparser *this)
+{
+	free(this->tracks);
+	this->tracks = NULL;
+
+	if (this->buf != NULL) {
+		streambuf_free(this->buf);
+		this->buf = NULL;
+	}
+}
+
+int midiparser_parse_tracks(Midiparser *this)
+{
+	for (int i = 0; i < this->ntrks; i++) {
+		//A note event takes at least 3 bytes (delta-time, key and velocity
+		//with running status), so this is enough to never grow the track
+		MidiparserTrack *track = &this->tracks[i];
+		track->index = player_add_track(this->player, track->buf.size / 3);
+		if (track->index < 0) {
+			return -1;
+		}
+	}
+
+	if (this->format == 2) {
+		//Independent patterns played one after the other: each track
+		//starts when the previous one ends
+		for (int i = 0; i < this->ntrks; i++) {
+			if (i > 0) {
+				this->tracks[i].tick = this->tracks[i - 1].tick;
+			}
+			midiparser_parse_track_task(this->tracks, i);
+			if (this->tracks[i].ret != 0) {
+				break;
+			}
+		}
+	}
+	else {
+		int jobs = this->jobs < this->ntrks ? this->jobs : this->ntrks;
+		Threadpool *pool = threadpool_new(jobs);
+		if (pool == NULL) {
+			return -1;
 		}
-		if (midiparser_parse_track(this, player, buf) != 0) {
+		threadpool_run(pool, (ThreadpoolTask) midiparser_parse_track_task, this->tracks, this->ntrks);
+		threadpool_free(pool);
+	}
+
+	for (int i = 0; i < this->ntrks; i++) {
+		if (this->tracks[i].ret != 0) {
 			print_error("Could not parse track #%d", i + 1);
 			return -1;
 		}
@@ -587,22 +621,56 @@ int midiparser_parse(Midiparser *this, Player *player, Streambuf *buf)
 	return 0;
 }
 
-int midiparser_parse_file(Midiparser *this, Player *player, char const *filename)
+//Single track files can be played while they are parsed
+bool midiparser_is_streamable(Midiparser *this)
 {
-	int ret = -1;
+	return this->format == 0 && this->ntrks == 1;
+}
 
-	Streambuf *buf = streambuf_new();
-	if (buf == NULL) {
-		return -1;
-	}
+static bool midiparser_track_next_is_simultaneous(MidiparserTrack *this)
+{
+	size_t offset = this->buf.read_offset;
+	uint32_t delta_time;
+	int ret = streambuf_read_vlq(&this->buf, &delta_time);
+	this->buf.read_offset = offset;
+	return ret == 0 && delta_time == 0;
+}
 
-	if (streambuf_open(buf, filename) != 0) {
-		goto exit;
+//Parse at least count events of a single track file, and the following
+//ones of the same tick. Returns 1 once the track is complete.
+int midiparser_parse_events(Midiparser *this, size_t count)
+{
+	MidiparserTrack *track = &this->tracks[0];
+	if (track->index < 0) {
+		track->index = player_add_track(this->player, count);
+		if (track->index < 0) {
+			return -1;
+		}
 	}
-	ret = midiparser_parse(this, player, buf);
 
-exit:
-	streambuf_free(buf);
+	for (size_t n = 0; n < count || midiparser_track_next_is_simultaneous(track); n++) {
+		int ret = midiparser_parse_event(track);
+		if (ret < 0) {
+			print_error("Could not parse midi event");
+			return -1;
+		}
+		if (ret == 1) {
+			if (streambuf_available(&track->buf) != 0) {
+				print_error("Unexpected end of track");
+				return -1;
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
 
+int midiparser_parse_file(Midiparser *this, Player *player, char const *filename)
+{
+	int ret = -1;
+	if (midiparser_open(this, player, filename) == 0) {
+		ret = midiparser_parse_tracks(this);
+	}
+	midiparser_close(this);
 	return ret;
 }
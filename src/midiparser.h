@@ -20,21 +20,42 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #include "player.h"
+#include "streambuf.h"
+
+//Parsing state of a MTrk chunk
+struct midiparser_track {
+	Player *player;
+	Streambuf buf;
+	int index;
+	uint32_t tick;
+	uint8_t last_evt;
+	int ret;
+};
+
+typedef struct midiparser_track MidiparserTrack;
 
 struct midiparser {
 	int ntrks;
 	int format;
 	int division;
-	int tempo;
-	uint8_t last_evt;
+	int jobs;
+	MidiparserTrack *tracks;
+	Streambuf *buf;
+	Player *player;
 };
 
 typedef struct midiparser Midiparser;
 
-Midiparser *midiparser_new(void);
+Midiparser *midiparser_new(int jobs);
 void midiparser_free(Midiparser *this);
+int midiparser_open(Midiparser *this, Player *player, char const *filename);
+void midiparser_close(Midiparser *this);
+int midiparser_parse_tracks(Midiparser *this);
+bool midiparser_is_streamable(Midiparser *this);
+int midiparser_parse_events(Midiparser *this, size_t count);
 int midiparser_parse_file(Midiparser *this, Player *player, char const *filename);
 
 #define MIDIFILE_MAGIC_MTHD 0x4d546864
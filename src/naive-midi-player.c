@@ -29,6 +29,7 @@
 #include "temperament_equal.h"
 #include "temperament_dom_bedos.h"
 #include "module.h"
+#include "threadpool.h"
 
 #ifdef CONFIG_SAMPLER
 #include <sampler/sampler_module.h>
@@ -46,6 +47,7 @@ struct Options_ {
 	float pitch;
 	char const *temperament;
 	int transposition;
+	int jobs;
 };
 
 #define DEFAULT_SPEED 1
@@ -57,7 +59,8 @@ struct Options_ options = {
 	.speed = DEFAULT_SPEED,
 	.temperament = DEFAULT_TEMPERAMENT,
 	.pitch = DEFAULT_PITCH,
-	.transposition = 0
+	.transposition = 0,
+	.jobs = 0
 };
 
 void print_error(const char *fmt, ...)
@@ -85,6 +88,7 @@ static void usage(List *modules, char const *app)
 	temperaments_list("                                     * ");
 	printf("\n");
 	printf("   -p,  --pitch                      Set pitch (default: %.1f hz)\n", DEFAULT_PITCH);
+	printf("   -j,  --jobs                       Set parser threads (default: online CPUs)\n");
 
 	modules_usage(modules);
 }
@@ -102,6 +106,7 @@ int parse_args(List *modules, int argc, char const *argv[])
 		{ "temperament", 1, NULL, 'T' },
 		{ "pitch", 1, NULL, 'p' },
 		{ "transpose", 1, NULL, 't' },
+		{ "jobs", 1, NULL, 'j' },
 		{ "version", 0, NULL, 'v' },
 		{ "help", 0, NULL, 'h' },
 		{ NULL, 0, NULL, 0}
@@ -133,6 +138,13 @@ int parse_args(List *modules, int argc, char const *argv[])
 			case 'p':
 				options.pitch = atoi(optarg);
 				break;
+			case 'j':
+				options.jobs = atoi(optarg);
+				if (options.jobs < 1) {
+					print_error("Unexpected 'jobs'");
+					return -1;
+				}
+				break;
 			case 'v':
 				version(argv[0]);
 				exit(EXIT_SUCCESS);
@@ -159,6 +171,10 @@ int parse_args(List *modules, int argc, char const *argv[])
 
 	options.input = argv[optind++];
 
+	if (options.jobs == 0) {
+		options.jobs = threadpool_get_online_cpus();
+	}
+
 	if (options.speed == 0) {
 		print_error("Unexpected 'speed'");
 		return -1;
@@ -225,12 +241,21 @@ int main(int argc, char const *argv[])
 	}
 
 	//Init Midiparser
-	midiparser = midiparser_new();
+	midiparser = midiparser_new(options.jobs);
 	if (midiparser == NULL) {
 		goto exit;
 	}
 
-	if (midiparser_parse_file(midiparser, player, options.input) == 0) {
+	if (midiparser_open(midiparser, player, options.input) != 0) {
+		goto exit;
+	}
+
+	//Engines rendering the timeline on their own need every track parsed
+	if (midiparser_is_streamable(midiparser) && !player_engine_can_render(player_engine)) {
+		player_info(player);
+		ret = player_play_stream(player, (PlayerFeedCB) midiparser_parse_events, midiparser);
+	}
+	else if (midiparser_parse_tracks(midiparser) == 0) {
 		player_info(player);
 		ret = player_play(player);
 	}
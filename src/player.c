@@ -21,111 +21,227 @@
 #include <stdlib.h>
 #include <math.h>
 
-#include "list_qsort.h"
+#include "eventmerge.h"
 #include "common.h"
 
-Event *event_new(int time, int channel, int note, int velocity, bool state)
+Player *player_new(PlayerEngine *engine, float speed, int transposition)
 {
-	Event *this = malloc(sizeof(Event));
+	Player *this = malloc(sizeof(Player));
 	if (this == NULL) {
 		return NULL;
 	}
-	this->time = time;
-	this->channel = channel;
-	this->note = note;
-	this->velocity = velocity;
-	this->state = state;
+	this->tempomap = tempomap_new();
+	if (this->tempomap == NULL) {
+		free(this);
+		return NULL;
+	}
+
+	this->tracks = NULL;
+	this->ntracks = 0;
+	this->engine = engine;
+	this->speed = speed;
+	this->transposition = transposition;
 	return this;
 }
 
-void event_free(Event *this)
+void player_free(Player *this)
 {
+	for (int i = 0; i < this->ntracks; i++) {
+		eventbuf_free(this->tracks[i]);
+	}
+	free(this->tracks);
+	tempomap_free(this->tempomap);
 	free(this);
 }
 
-int event_cmp_time(Event *a, Event *b)
+void player_set_division(Player *this, int division)
 {
-	if (a->time == b->time) {
-		if (a->state == b->state) {
-			return 0;
-		}
-		return a->state ? 1 : -1;
-	}
-	return a->time > b->time ? 1 : -1;
+	tempomap_set_division(this->tempomap, division);
 }
 
-Player *player_new(PlayerEngine *engine, float speed, int transposition)
+//Tempo changes apply to all tracks
+int player_set_tempo(Player *this, int track, uint32_t tick, uint32_t tempo)
 {
-	Player *this = malloc(sizeof(Player));
-	if (this == NULL) {
-		return NULL;
+	return tempomap_add(this->tempomap, track, tick, tempo);
+}
+
+//Add a run of events and return its index. Once all the tracks are
+//added, they can be filled concurrently.
+int player_add_track(Player *this, size_t reserve)
+{
+	Eventbuf **tracks = realloc(this->tracks, (this->ntracks + 1) * sizeof(Eventbuf *));
+	if (tracks == NULL) {
+		return -1;
 	}
-	this->events = list_new();
-	if (this->events == NULL) {
-		free(this);
-		return NULL;
+	this->tracks = tracks;
+
+	Eventbuf *track = eventbuf_new();
+	if (track == NULL) {
+		return -1;
+	}
+	if (eventbuf_reserve(track, reserve) != 0) {
+		eventbuf_free(track);
+		return -1;
 	}
 
-	this->engine = engine;
-	this->time = 0;
-	this->speed = speed;
-	this->transposition = transposition;
-	return this;
+	this->tracks[this->ntracks] = track;
+	return this->ntracks++;
 }
 
-void player_free(Player *this)
+int player_set_note(Player *this, int track, uint32_t tick, int channel, int note, int velocity, bool state)
 {
-	list_free(this->events, (ListFreeCB) event_free);
-	free(this);
+	Event *event = eventbuf_append(this->tracks[track]);
+	if (event == NULL) {
+		return -1;
+	}
+
+	event->tick = tick;
+	event->channel = channel;
+	event->note = note;
+	event->velocity = velocity;
+	event->state = state;
+	return 0;
 }
 
-void player_time_forward(Player *this, int ms)
+//Tracks are tick-ordered already, sorting only settles simultaneous events
+static int player_prepare_track(Player *this, Eventbuf *track)
 {
-	this->time += ms;
+	if (eventbuf_sort(track) != 0) {
+		print_error("Could not sort events");
+		return -1;
+	}
+	tempomap_convert(this->tempomap, track->events, track->count);
+	return 0;
 }
 
-void player_time_reset(Player *this)
+//Wait for the event time and send it to the engine, returns false when
+//playback is interrupted
+static bool player_play_event(Player *this, PlayerEngine *engine, Event const *event, int64_t *time)
 {
-	this->time = 0;
+	if (event->time > *time) {
+		useconds_t delay = (float) (event->time - *time) / this->speed;
+		DMSG("wait(%d)", delay);
+		if (player_engine_wait(engine, delay) != 0) {
+			return false;
+		}
+		player_engine_show_progress(engine);
+	}
+	if (sig_int == true) {
+		return false;
+	}
+	*time = event->time;
+	player_engine_set_note(engine, event->channel, event->note + this->transposition, event->velocity, event->state);
+	return true;
 }
 
-int player_set_note(Player *this, int channel, int note, int velocity, bool state)
+//Play the prepared tracks, merged on the fly. May run concurrently on
+//distinct engines.
+static int player_replay(Player *this, PlayerEngine *engine)
 {
-	Event *event = event_new(this->time, channel, note, velocity, state);
-	if (event == NULL) {
+	Eventmerge *merge = eventmerge_new(this->tracks, this->ntracks);
+	if (merge == NULL) {
 		return -1;
 	}
 
-	list_append(this->events, (ListItem *) event);
+	int64_t time = 0;
+	Event const *event;
+	while ((event = eventmerge_next(merge)) != NULL) {
+		if (player_play_event(this, engine, event, &time) == false) {
+			break;
+		}
+	}
+
+	eventmerge_free(merge);
 	return 0;
 }
 
+//Time of the last event, once scaled by the speed
+static int64_t player_get_duration(Player *this)
+{
+	int64_t duration = 0;
+	for (int i = 0; i < this->ntracks; i++) {
+		Eventbuf *track = this->tracks[i];
+		if (track->count > 0 && track->events[track->count - 1].time > duration) {
+			duration = track->events[track->count - 1].time;
+		}
+	}
+	return (float) duration / this->speed;
+}
+
 int player_play(Player *this)
 {
-	player_engine_open(this->engine);
+	if (tempomap_build(this->tempomap) != 0) {
+		return -1;
+	}
+
+	for (int i = 0; i < this->ntracks; i++) {
+		if (player_prepare_track(this, this->tracks[i]) != 0) {
+			return -1;
+		}
+	}
+
+	if (player_engine_open(this->engine) != 0) {
+		return -1;
+	}
 	player_engine_show_progress_open(this->engine);
 
-	int time = 0;
-	list_qsort(this->events, (ListCmpCB) event_cmp_time);
-	ListNode *node;
-	LIST_FOREACH(this->events, node) {
-		Event *event = (Event *) node->item;
-		if (event->time > time) {
-			int delay = (float) (event->time - time) / this->speed;
-			DMSG("wait(%d)", delay);
-			player_engine_wait(this->engine, delay);
-			player_engine_show_progress(this->engine);
+	int ret = player_engine_render(this->engine, player_get_duration(this), (PlayerEngineReplayCB) player_replay, this);
+	if (ret > 0) {
+		ret = player_replay(this, this->engine);
+	}
+
+	//Buffered output may only fail once flushed
+	if (player_engine_close(this->engine) != 0) {
+		ret = -1;
+	}
+	player_engine_show_progress_close(this->engine);
+	return ret < 0 ? -1 : 0;
+}
+
+//Play a single track while it is being parsed, only a window of events
+//is kept in memory
+int player_play_stream(Player *this, PlayerFeedCB feed, void *ctx)
+{
+	if (player_engine_open(this->engine) != 0) {
+		return -1;
+	}
+	player_engine_show_progress_open(this->engine);
+
+	int64_t time = 0;
+	int ret;
+	do {
+		ret = feed(ctx, PLAYER_STREAM_WINDOW);
+		if (ret < 0 || this->ntracks != 1) {
+			ret = -1;
+			break;
 		}
-		if (sig_int == true) {
+		Eventbuf *track = this->tracks[0];
+
+		//Tempo changes up to the last fed tick are known
+		if (tempomap_build(this->tempomap) != 0 || player_prepare_track(this, track) != 0) {
+			ret = -1;
 			break;
 		}
-		time = event->time;
-		player_engine_set_note(this->engine, event->channel, event->note + this->transposition, event->velocity, event->state);
-	}
 
-	player_engine_close(this->engine);
+		bool stopped = false;
+		Event const *event;
+		EVENTBUF_FOREACH(track, event) {
+			if (player_play_event(this, this->engine, event, &time) == false) {
+				stopped = true;
+				break;
+			}
+		}
+		eventbuf_clear(track);
+		if (stopped) {
+			break;
+		}
+	} while (ret == 0 && sig_int == false);
+
+	if (player_engine_close(this->engine) != 0) {
+		ret = -1;
+	}
 	player_engine_show_progress_close(this->engine);
-	return 0;
+	return ret < 0 ? -1 : 0;
 }
 
 void player_info(Player *this)
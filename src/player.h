@@ -19,36 +19,37 @@
 #define PLAYER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
-#include "list.h"
+#include "eventbuf.h"
+#include "tempomap.h"
 #include "player_engine.h"
 
-struct event {
-	int time;
-	int channel;
-	int note;
-	int velocity;
-	bool state;
-};
-
-typedef struct event Event;
-
 struct player {
 	PlayerEngine *engine;
-	List *events;
-	int time;
+	Eventbuf **tracks;
+	int ntracks;
+	Tempomap *tempomap;
 	float speed;
 	int transposition;
 };
 
 typedef struct player Player;
 
+//Append at least count events to the first track, returns 1 at the end
+//of the track. Events of a same tick must be fed together.
+typedef int (*PlayerFeedCB)(void *ctx, size_t count);
+
+#define PLAYER_STREAM_WINDOW 1024
+
 Player *player_new(PlayerEngine *engine, float speed, int transposition);
 void player_free(Player *this);
-void player_time_forward(Player *this, int ms);
-void player_time_reset(Player *this);
-int player_set_note(Player *this, int channel, int note, int velocity, bool state);
+void player_set_division(Player *this, int division);
+int player_set_tempo(Player *this, int track, uint32_t tick, uint32_t tempo);
+int player_add_track(Player *this, size_t reserve);
+int player_set_note(Player *this, int track, uint32_t tick, int channel, int note, int velocity, bool state);
 int player_play(Player *this);
+int player_play_stream(Player *this, PlayerFeedCB feed, void *ctx);
 void player_info(Player *this);
 
 #endif
@@ -31,9 +31,27 @@ int player_engine_set_note(PlayerEngine *this, int channel, int note, int veloci
 	return this->class_def->set_note(this, channel, note, velocity, state);
 }
 
-void player_engine_wait(PlayerEngine *this, useconds_t usec)
+int player_engine_wait(PlayerEngine *this, useconds_t usec)
 {
-	this->class_def->wait(this, usec);
+	return this->class_def->wait(this, usec);
+}
+
+//Returns 1 when the engine does not render on its own, the timeline
+//must then be played in real time
+int player_engine_render(PlayerEngine *this, int64_t duration, PlayerEngineReplayCB replay, void *ctx)
+{
+	if (this->class_def->render == NULL) {
+		return 1;
+	}
+	return this->class_def->render(this, duration, replay, ctx);
+}
+
+bool player_engine_can_render(PlayerEngine *this)
+{
+	if (this->class_def->render == NULL || this->class_def->can_render == NULL) {
+		return false;
+	}
+	return this->class_def->can_render(this);
 }
 
 int player_engine_open(PlayerEngine *this)
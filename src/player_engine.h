@@ -19,6 +19,7 @@
 #define PLAYER_ENGINE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
 struct player_engine;
@@ -34,6 +35,12 @@ typedef void (* PlayerEngineShowProgress)(PlayerEngine *this);
 typedef void (* PlayerEngineShowProgressOpen)(PlayerEngine *this);
 typedef void (* PlayerEngineShowProgressClose)(PlayerEngine *this);
 
+//Play the whole timeline into the given engine, stops early when the
+//engine wait returns non zero
+typedef int (* PlayerEngineReplayCB)(void *ctx, PlayerEngine *engine);
+typedef int (* PlayerEngineRender)(PlayerEngine *this, int64_t duration, PlayerEngineReplayCB replay, void *ctx);
+typedef bool (* PlayerEngineCanRender)(PlayerEngine *this);
+
 struct player_engine_class_def {
 	char const *name;
 	PlayerEngineFree free;
@@ -45,6 +52,10 @@ struct player_engine_class_def {
 	PlayerEngineShowProgress show_progress_open;
 	PlayerEngineShowProgress show_progress;
 	PlayerEngineShowProgress show_progress_close;
+
+	//Optional, offline engines may render the timeline on their own
+	PlayerEngineRender render;
+	PlayerEngineCanRender can_render; //the whole timeline is then needed
 };
 
 typedef struct player_engine_class_def PlayerEngineClassDef;
@@ -58,7 +69,9 @@ struct player_engine {
 
 void player_engine_free(PlayerEngine *this);
 int player_engine_set_note(PlayerEngine *this, int channel, int note, int velocity, bool state);
-void player_engine_wait(PlayerEngine *this, useconds_t usec);
+int player_engine_wait(PlayerEngine *this, useconds_t usec);
+int player_engine_render(PlayerEngine *this, int64_t duration, PlayerEngineReplayCB replay, void *ctx);
+bool player_engine_can_render(PlayerEngine *this);
 int player_engine_open(PlayerEngine *this);
 int player_engine_close(PlayerEngine *this);
 void player_engine_info(PlayerEngine *this);
@@ -19,40 +19,88 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include <common.h>
 
 #include "endianness.h"
 
-CodecWav *codec_wav_new(int sample_size, int channels, int sample_rate, char const *filename)
+//Keep the real stdout for the samples and send everything printed from
+//now on to stderr, messages would otherwise end up in the audio stream
+static FILE *codec_wav_take_stdout(void)
+{
+	fflush(stdout);
+
+	int fd = dup(STDOUT_FILENO);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	FILE *f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+	}
+	return f;
+}
+
+CodecWav *codec_wav_new(PcmbufFormat format, CodecWavContainer container, int channels, int sample_rate, char const *filename)
 {
 	CodecWav *this = malloc(sizeof(CodecWav));
 	if (this == NULL) {
 		return NULL;
 	}
 
-	this->sample_size = sample_size;
+	this->format = format;
+	this->container = container;
+	this->sample_size = pcmbuf_format_get_size(format);
 	this->channels = channels;
 	this->sample_rate = sample_rate;
 	this->length = 0;
 	this->filename = filename;
 	this->f = NULL;
+	this->streaming = false;
+	this->header_offset = 0;
+	this->blocks = NULL;
+	this->writing = false;
+
+	//Taken now, before anything is printed
+	if (strcmp(filename, CODEC_WAV_STDOUT) == 0) {
+		this->f = codec_wav_take_stdout();
+		if (this->f == NULL) {
+			print_error("Could not redirect stdout");
+			free(this);
+			return NULL;
+		}
+	}
 
 	return this;
 }
 
+static int codec_wav_stop_writer(CodecWav *this);
+
 void codec_wav_free(CodecWav *this)
 {
+	codec_wav_stop_writer(this);
+	free(this->blocks);
 	if (this->f != NULL) {
 		fclose(this->f);
 	}
 	free(this);
 }
 
-struct codec_wav_header_footprint {
+struct codec_wav_riff_footprint {
 	char chunk_id[4];
 	le32_t chunk_size;
 	char format[4];
+} __attribute__((packed));
+
+struct codec_wav_fmt_footprint {
 	char subchunk1_id[4];
 	le32_t subchunk1_size;
 	le16_t audio_format;
@@ -61,60 +109,297 @@ struct codec_wav_header_footprint {
 	le32_t byte_rate;
 	le16_t block_align;
 	le16_t bits_per_sample;
+	//WAVE_FORMAT_EXTENSIBLE only
+	le16_t extension_size;
+	le16_t valid_bits_per_sample;
+	le32_t channel_mask;
+	unsigned char sub_format[16];
+} __attribute__((packed));
+
+//Required with non PCM formats
+struct codec_wav_fact_footprint {
+	char chunk_id[4];
+	le32_t chunk_size;
+	le32_t sample_length;
+} __attribute__((packed));
+
+struct codec_wav_data_footprint {
 	char subchunk2_id[4];
 	le32_t subchunk2_size;
 } __attribute__((packed));
 
-static int codec_wav_write_header(CodecWav *this)
+#define CODEC_WAV_FORMAT_PCM 1
+#define CODEC_WAV_FORMAT_IEEE_FLOAT 3
+#define CODEC_WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+//KSDATAFORMAT_SUBTYPE_PCM and _IEEE_FLOAT, the first byte is the format
+static unsigned char const codec_wav_sub_format[16] = {
+	0, 0, 0, 0, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+};
+
+//Speakers in the usual order: front left, front right, front center, LFE...
+static uint32_t codec_wav_get_channel_mask(int channels)
 {
+	if (channels == 1) {
+		return 0x4;
+	}
+	return ((uint32_t) 1 << channels) - 1;
+}
+
+#define CODEC_WAV_HEADER_MAX (sizeof(struct codec_wav_riff_footprint) \
+	+ sizeof(struct codec_wav_fmt_footprint) \
+	+ sizeof(struct codec_wav_fact_footprint) \
+	+ sizeof(struct codec_wav_data_footprint))
+
+//Sizes of a stream whose length is not known, as most readers expect
+#define CODEC_WAV_UNKNOWN_SIZE 0xFFFFFFFF
+
+//Fill the header for the current length, returns its size. The size
+//only depends on the format, so the placeholder written at open can be
+//overwritten at close.
+static size_t codec_wav_get_header(CodecWav *this, unsigned char *dst)
+{
+	bool floating = this->format == PCMBUF_FORMAT_F32;
+	//Readers need the channel mask and sub format beyond stereo 16 bits
+	bool extensible = this->channels > 2 || this->sample_size > 2;
+	int audio_format = floating ? CODEC_WAV_FORMAT_IEEE_FLOAT : CODEC_WAV_FORMAT_PCM;
 	size_t data_size = this->length * this->channels * this->sample_size;
 
-	struct codec_wav_header_footprint header;
-	memcpy(&header.chunk_id, "RIFF", 4);
-	le32_set(&header.chunk_size, 36 + data_size);
-	memcpy(&header.format, "WAVE", 4);
+	struct codec_wav_riff_footprint riff;
+	struct codec_wav_fmt_footprint fmt;
+	struct codec_wav_fact_footprint fact;
+	struct codec_wav_data_footprint data;
+
+	//Float samples are 32 bits, so the plain layout is only integer PCM
+	size_t fmt_size = extensible ? sizeof(fmt) : offsetof(struct codec_wav_fmt_footprint, extension_size);
+	size_t size = sizeof(riff) + fmt_size + (floating ? sizeof(fact) : 0) + sizeof(data);
+
+	uint32_t riff_size = size - 8 + data_size;
+	uint32_t sample_length = this->length;
+	if (this->streaming) {
+		riff_size = CODEC_WAV_UNKNOWN_SIZE;
+		data_size = CODEC_WAV_UNKNOWN_SIZE;
+		sample_length = CODEC_WAV_UNKNOWN_SIZE;
+	}
+
+	memcpy(&riff.chunk_id, "RIFF", 4);
+	le32_set(&riff.chunk_size, riff_size);
+	memcpy(&riff.format, "WAVE", 4);
+
+	memcpy(&fmt.subchunk1_id, "fmt ", 4);
+	le32_set(&fmt.subchunk1_size, fmt_size - 8);
+	le16_set(&fmt.audio_format, extensible ? CODEC_WAV_FORMAT_EXTENSIBLE : audio_format);
+	le16_set(&fmt.num_channels, this->channels);
+	le32_set(&fmt.sample_rate, this->sample_rate);
+	le32_set(&fmt.byte_rate, this->sample_rate * this->channels * this->sample_size);
+	le16_set(&fmt.block_align, this->channels * this->sample_size);
+	le16_set(&fmt.bits_per_sample, this->sample_size * 8);
+	le16_set(&fmt.extension_size, sizeof(fmt) - offsetof(struct codec_wav_fmt_footprint, valid_bits_per_sample));
+	le16_set(&fmt.valid_bits_per_sample, this->sample_size * 8);
+	le32_set(&fmt.channel_mask, codec_wav_get_channel_mask(this->channels));
+	memcpy(&fmt.sub_format, codec_wav_sub_format, sizeof(fmt.sub_format));
+	fmt.sub_format[0] = audio_format;
+
+	memcpy(&fact.chunk_id, "fact", 4);
+	le32_set(&fact.chunk_size, 4);
+	le32_set(&fact.sample_length, sample_length);
+
+	memcpy(&data.subchunk2_id, "data", 4);
+	le32_set(&data.subchunk2_size, data_size);
 
-	memcpy(&header.subchunk1_id, "fmt ", 4);
-	le32_set(&header.subchunk1_size, 16);
-	le16_set(&header.audio_format, 1);
-	le16_set(&header.num_channels, this->channels);
-	le32_set(&header.sample_rate, this->sample_rate);
-	le32_set(&header.byte_rate, this->sample_rate * this->channels * this->sample_size);
-	le16_set(&header.block_align, this->channels * this->sample_size);
-	le16_set(&header.bits_per_sample, this->sample_size * 8);
+	size_t offset = 0;
+	memcpy(dst + offset, &riff, sizeof(riff));
+	offset += sizeof(riff);
+	memcpy(dst + offset, &fmt, fmt_size);
+	offset += fmt_size;
+	if (floating) {
+		memcpy(dst + offset, &fact, sizeof(fact));
+		offset += sizeof(fact);
+	}
+	memcpy(dst + offset, &data, sizeof(data));
+	offset += sizeof(data);
+	return offset;
+}
 
-	memcpy(&header.subchunk2_id, "data", 4);
-	le32_set(&header.subchunk2_size, data_size);
+static int codec_wav_write_header(CodecWav *this)
+{
+	unsigned char header[CODEC_WAV_HEADER_MAX];
+	size_t size = codec_wav_get_header(this, header);
 
-	if (fwrite(&header, sizeof(header), 1, this->f) != sizeof(header)) {
+	if (fwrite(header, 1, size, this->f) != size) {
 		return -1;
 	}
 
 	return 0;
 }
 
-int codec_wav_open(CodecWav *this)
+//sem_wait is interrupted by signals whatever SA_RESTART says
+static void codec_wav_sem_wait(sem_t *sem)
 {
-	FILE *f = fopen(this->filename, "w");
-	if (f == NULL) {
-		print_error("Could not open output file: '%s'", this->filename);
+	while (sem_wait(sem) != 0);
+}
+
+static void *codec_wav_writer(void *arg)
+{
+	CodecWav *this = arg;
+	size_t frame_size = this->channels * this->sample_size;
+
+	for (;;) {
+		codec_wav_sem_wait(&this->filled_blocks);
+		CodecWavBlock *block = &this->ring[this->tail];
+		if (block->last) {
+			break;
+		}
+
+		size_t size = block->length * frame_size;
+		if (!atomic_load(&this->failed) && fwrite(block->data, 1, size, this->f) != size) {
+			print_error("Could not write output file: '%s'", this->filename);
+			atomic_store(&this->failed, true);
+		}
+
+		this->tail = (this->tail + 1) % CODEC_WAV_RING_SIZE;
+		sem_post(&this->free_blocks);
+	}
+
+	return NULL;
+}
+
+static int codec_wav_start_writer(CodecWav *this)
+{
+	size_t block_size = CODEC_WAV_BLOCK_LENGTH * this->channels * this->sample_size;
+	this->blocks = malloc(CODEC_WAV_RING_SIZE * block_size);
+	if (this->blocks == NULL) {
+		return -1;
+	}
+
+	for (int i = 0; i < CODEC_WAV_RING_SIZE; i++) {
+		this->ring[i].data = this->blocks + i * block_size;
+	}
+	this->head = 0;
+	this->tail = 0;
+	atomic_init(&this->failed, false);
+
+	if (sem_init(&this->free_blocks, 0, CODEC_WAV_RING_SIZE) != 0) {
+		return -1;
+	}
+	if (sem_init(&this->filled_blocks, 0, 0) != 0) {
+		sem_destroy(&this->free_blocks);
+		return -1;
+	}
+	if (pthread_create(&this->writer, NULL, codec_wav_writer, this) != 0) {
+		sem_destroy(&this->free_blocks);
+		sem_destroy(&this->filled_blocks);
 		return -1;
 	}
-	this->f = f;
 
-	struct codec_wav_header_footprint header;
-	bzero(&header, sizeof(header));
+	this->writing = true;
+	return 0;
+}
+
+//Blocks while the writer is behind by a whole ring, NULL once the
+//output failed or when it was never opened
+static CodecWavBlock *codec_wav_get_block(CodecWav *this)
+{
+	if (!this->writing || atomic_load(&this->failed)) {
+		return NULL;
+	}
+	codec_wav_sem_wait(&this->free_blocks);
+	return &this->ring[this->head];
+}
+
+static int codec_wav_put_block(CodecWav *this, CodecWavBlock *block, size_t length)
+{
+	block->length = length;
+	block->last = false;
+	this->head = (this->head + 1) % CODEC_WAV_RING_SIZE;
+	sem_post(&this->filled_blocks);
+
+	this->length += length;
+	return atomic_load(&this->failed) ? -1 : 0;
+}
+
+//Wait for the pending blocks to be written
+static int codec_wav_stop_writer(CodecWav *this)
+{
+	if (!this->writing) {
+		return 0;
+	}
+
+	codec_wav_sem_wait(&this->free_blocks);
+	this->ring[this->head].last = true;
+	sem_post(&this->filled_blocks);
+
+	pthread_join(this->writer, NULL);
+	sem_destroy(&this->free_blocks);
+	sem_destroy(&this->filled_blocks);
+	this->writing = false;
+
+	return atomic_load(&this->failed) ? -1 : 0;
+}
+
+int codec_wav_open(CodecWav *this)
+{
+	if (this->f == NULL) {
+		this->f = fopen(this->filename, "w");
+		if (this->f == NULL) {
+			print_error("Could not open output file: '%s'", this->filename);
+			return -1;
+		}
+	}
+
+	//Pipes and terminals cannot go back to the header, appended writes
+	//would land after the samples. A redirected stdout may not start at
+	//offset 0.
+	int flags = fcntl(fileno(this->f), F_GETFL);
+	this->header_offset = ftell(this->f);
+	this->streaming = this->header_offset < 0 || flags < 0 || (flags & O_APPEND) != 0;
+
+	//Placeholder, rewritten once the length is known
+	if (this->container == CODEC_WAV_CONTAINER_WAV && codec_wav_write_header(this) != 0) {
+		return -1;
+	}
 
-	fwrite(&header, 1, sizeof(header), this->f);
+	if (codec_wav_start_writer(this) != 0) {
+		print_error("Could not start the output writer");
+		return -1;
+	}
 	return 0;
 }
 
+//The frames are converted straight into the ring
 int codec_wav_write_pcmbuf(CodecWav *this, Pcmbuf *pcmbuf)
 {
-	if (pcmbuf_fwrite_interlaced_le(pcmbuf, this->f) != 0) {
+	if (pcmbuf->length > CODEC_WAV_BLOCK_LENGTH) {
 		return -1;
 	}
-	this->length += pcmbuf->length;
+
+	CodecWavBlock *block = codec_wav_get_block(this);
+	if (block == NULL) {
+		return -1;
+	}
+	pcmbuf_convert_le(pcmbuf, block->data);
+	return codec_wav_put_block(this, block, pcmbuf->length);
+}
+
+//Write length frames already in the output format
+int codec_wav_write(CodecWav *this, void const *data, size_t length)
+{
+	size_t frame_size = this->channels * this->sample_size;
+	unsigned char const *src = data;
+
+	while (length > 0) {
+		size_t count = length < CODEC_WAV_BLOCK_LENGTH ? length : CODEC_WAV_BLOCK_LENGTH;
+		CodecWavBlock *block = codec_wav_get_block(this);
+		if (block == NULL) {
+			return -1;
+		}
+		memcpy(block->data, src, count * frame_size);
+		if (codec_wav_put_block(this, block, count) != 0) {
+			return -1;
+		}
+		src += count * frame_size;
+		length -= count;
+	}
 	return 0;
 }
 
@@ -124,12 +409,18 @@ int codec_wav_close(CodecWav *this)
 		return -1;
 	}
 
-	if (fseek(this->f, 0, SEEK_SET) != 0) {
+	if (codec_wav_stop_writer(this) != 0) {
 		return -1;
 	}
 
-	if (codec_wav_write_header(this) != 0) {
-		return -1;
+	if (this->container == CODEC_WAV_CONTAINER_WAV && !this->streaming) {
+		if (fseek(this->f, this->header_offset, SEEK_SET) != 0) {
+			return -1;
+		}
+
+		if (codec_wav_write_header(this) != 0) {
+			return -1;
+		}
 	}
 
 	if (fclose(this->f) != 0) {
@@ -18,27 +18,70 @@
 #ifndef CODEC_WAV
 #define CODEC_WAV
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "pcmbuf.h"
 
+//Output written to stdout
+#define CODEC_WAV_STDOUT "-"
+
+enum codec_wav_container {
+	CODEC_WAV_CONTAINER_WAV,
+	CODEC_WAV_CONTAINER_RAW, //bare interleaved samples
+};
+
+typedef enum codec_wav_container CodecWavContainer;
+
+#define CODEC_WAV_RING_SIZE 4
+#define CODEC_WAV_BLOCK_LENGTH 1024
+
+//Frames waiting in the ring for the writer thread
+struct codec_wav_block {
+	unsigned char *data;
+	size_t length;
+	bool last; //asks the writer to stop
+};
+
+typedef struct codec_wav_block CodecWavBlock;
+
 struct codec_wav {
+	PcmbufFormat format;
+	CodecWavContainer container;
 	int sample_size;
 	int channels;
 	int sample_rate;
 	size_t length;
 	char const *filename;
 	FILE *f;
+	bool streaming; //not seekable, the header is never patched
+	long header_offset;
+
+	//Single producer single consumer ring: the renderer fills the block at
+	//head, the writer thread empties the one at tail
+	unsigned char *blocks;
+	CodecWavBlock ring[CODEC_WAV_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+	sem_t free_blocks;
+	sem_t filled_blocks;
+	pthread_t writer;
+	bool writing;
+	atomic_bool failed;
 };
 
 typedef struct codec_wav CodecWav;
 
-CodecWav *codec_wav_new(int sample_size, int channels, int sample_rate, char const *filename);
+CodecWav *codec_wav_new(PcmbufFormat format, CodecWavContainer container, int channels, int sample_rate, char const *filename);
 void codec_wav_free(CodecWav *this);
 int codec_wav_open(CodecWav *this);
 int codec_wav_close(CodecWav *this);
 int codec_wav_write_pcmbuf(CodecWav *this, Pcmbuf *pcmbuf);
+int codec_wav_write(CodecWav *this, void const *data, size_t length);
 
 #endif
 
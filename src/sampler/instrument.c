@@ -24,18 +24,51 @@
 #include <common.h>
 #include <temperament.h>
 
-Instrument *instrument_new(float fondamental, int velocity, InstrumentProfile *profile)
+static void instrument_phasor_init(Instrument *this)
 {
-	Instrument *this = malloc(sizeof(Instrument));
+	InstrumentPhasor *phasor = &this->phasor;
+
+	//Skip the trailing vectors that only hold silent partials
+	int partials = 0;
+	for (int j = 0; j < INSTRUMENT_PARTIALS; j++) {
+		float gain = this->profile->spectrum[j] * (float) this->velocity / 127.0;
+		phasor->gain.f[j] = gain;
+		if (gain > 0) {
+			partials = j + 1;
+		}
+
+		double step = 2.0 * M_PI * this->fondamental * (double) (j + 1) / (double) this->samplerate;
+		phasor->step_re.f[j] = cos(step);
+		phasor->step_im.f[j] = sin(step);
+		phasor->re.f[j] = 1;
+		phasor->im.f[j] = 0;
+	}
+	phasor->vectors = (partials + INSTRUMENT_VECTOR_SIZE - 1) / INSTRUMENT_VECTOR_SIZE;
+	phasor->next = 0;
+}
+
+//Instruments are embedded in the pooled voices, they are initialised in
+//place
+void instrument_init(Instrument *this, float fondamental, int velocity, InstrumentProfile *profile, InstrumentOscillator oscillator, Wavetable *wavetable, unsigned int samplerate, float silence)
+{
+	this->silence = silence;
 	this->fondamental = fondamental;
 	this->velocity = velocity;
+	this->samplerate = samplerate;
 	this->profile = profile;
-	return this;
-}
+	this->oscillator = oscillator;
+	this->table = NULL;
 
-void instrument_free(Instrument *this)
-{
-	free(this);
+	switch (oscillator) {
+		case INSTRUMENT_OSCILLATOR_WAVETABLE:
+			this->table = wavetable_get_table(wavetable, fondamental);
+			break;
+		case INSTRUMENT_OSCILLATOR_PHASOR:
+			instrument_phasor_init(this);
+			break;
+		case INSTRUMENT_OSCILLATOR_SINE:
+			break;
+	}
 }
 
 float instrument_compute_partial(Instrument *this, int n, float t)
@@ -44,18 +77,103 @@ float instrument_compute_partial(Instrument *this, int n, float t)
 	return sin(t * freq * 2.0 * M_PI);
 }
 
+//Set the rotators to the exact phases of the given sample
+static void instrument_phasor_sync(Instrument *this, unsigned int sample)
+{
+	InstrumentPhasor *phasor = &this->phasor;
+	int partials = phasor->vectors * INSTRUMENT_VECTOR_SIZE;
+	for (int j = 0; j < partials; j++) {
+		double cycles = (double) this->fondamental * (double) (j + 1) * (double) sample / (double) this->samplerate;
+		double phase = 2.0 * M_PI * (cycles - floor(cycles));
+		phasor->re.f[j] = cos(phase);
+		phasor->im.f[j] = sin(phase);
+	}
+	phasor->next = sample;
+}
+
+static void instrument_phasor_step(InstrumentPhasor *phasor)
+{
+	for (int k = 0; k < phasor->vectors; k++) {
+		InstrumentVector re = phasor->re.v[k];
+		InstrumentVector im = phasor->im.v[k];
+		phasor->re.v[k] = re * phasor->step_re.v[k] - im * phasor->step_im.v[k];
+		phasor->im.v[k] = re * phasor->step_im.v[k] + im * phasor->step_re.v[k];
+	}
+	phasor->next++;
+}
+
+static float instrument_compute_phasor(Instrument *this, unsigned int sample)
+{
+	InstrumentPhasor *phasor = &this->phasor;
+
+	//Resync on every block boundary and whenever the caller jumped, always
+	//from the same absolute positions so the output does not depend on how
+	//the render was split
+	if (sample % INSTRUMENT_PHASOR_RESYNC == 0 || sample != phasor->next) {
+		instrument_phasor_sync(this, sample - sample % INSTRUMENT_PHASOR_RESYNC);
+		while (phasor->next != sample) {
+			instrument_phasor_step(phasor);
+		}
+	}
+
+	InstrumentLanes sum;
+	for (int k = 0; k < phasor->vectors; k++) {
+		sum.v[k] = phasor->im.v[k] * phasor->gain.v[k];
+	}
+	float value = 0;
+	for (int j = 0; j < phasor->vectors * INSTRUMENT_VECTOR_SIZE; j++) {
+		value += sum.f[j];
+	}
+
+	instrument_phasor_step(phasor);
+	return value;
+}
+
 //--- ADSR helper functions
 static float f(float x, float c)
 {
 	return (powf(2.0, 16.0 * c * x) - 1.0) / (powf(2.0, 16.0 * c) - 1.0);
 }
 
+static void instrument_curve_fill(float *table, float c)
+{
+	for (int i = 0; i <= INSTRUMENT_ENVELOPE_STEPS; i++) {
+		table[i] = f((float) i / INSTRUMENT_ENVELOPE_STEPS, c);
+	}
+}
+
+//f(x, c) read back from its table, x in [0, 1]
+static float instrument_curve(float const *table, float x)
+{
+	if (x <= 0) {
+		return table[0];
+	}
+	if (x >= 1) {
+		return table[INSTRUMENT_ENVELOPE_STEPS];
+	}
+	float pos = x * INSTRUMENT_ENVELOPE_STEPS;
+	int i = (int) pos;
+	float frac = pos - i;
+	return table[i] + (table[i + 1] - table[i]) * frac;
+}
+
+void instrument_profile_init(InstrumentProfile *profile)
+{
+	if (profile->initialized == true) {
+		return;
+	}
+	instrument_curve_fill(profile->attack, profile->a1);
+	instrument_curve_fill(profile->decay, profile->d1);
+	instrument_curve_fill(profile->release, profile->r1);
+	profile->initialized = true;
+}
+
 static float a(InstrumentProfile *profile, float x) {
-	return f(x / profile->a0, profile->a1);
+	return instrument_curve(profile->attack, x / profile->a0);
 }
 
 static float d(InstrumentProfile *profile, float x) {
-	return 1.0 - f(x / profile->d0, profile->d1) * (1.0 - profile->s1);
+	return 1.0 - instrument_curve(profile->decay, x / profile->d0) * (1.0 - profile->s1);
 }
 
 static float ds(InstrumentProfile *profile, float x)
@@ -67,7 +185,7 @@ static float ds(InstrumentProfile *profile, float x)
 
 static float r(InstrumentProfile *profile, float s, float x)
 {
-	return s * (1.0 - f(x / profile->r0, profile->r1));
+	return s * (1.0 - instrument_curve(profile->release, x / profile->r0));
 }
 
 float instrument_compute_envelope(Instrument *this, float duration, float t)
@@ -88,9 +206,12 @@ float instrument_compute_envelope(Instrument *this, float duration, float t)
 
 		if (t > duration) {
 			float dt = t - duration;
-			return (dt < profile->r0)
-				? r(profile, ds(profile, duration), dt)
-				: -1;
+			if (dt >= profile->r0) {
+				return -1;
+			}
+			//The release only decreases, once inaudible the note is over
+			float value = r(profile, ds(profile, duration), dt);
+			return value < this->silence ? -1 : value;
 		}
 	}
 
@@ -98,14 +219,36 @@ float instrument_compute_envelope(Instrument *this, float duration, float t)
 	return ds(profile, t - profile->a0);
 }
 
-float instrument_compute(Instrument *this, float duration, float t, bool *terminated)
+//Whether instrument_compute would have terminated at or before sample,
+//the envelope does not come back once released
+bool instrument_is_terminated(Instrument *this, float duration, unsigned int sample)
+{
+	float t = (float) sample / (float) this->samplerate;
+	return instrument_compute_envelope(this, duration, t) < 0;
+}
+
+float instrument_compute(Instrument *this, float duration, unsigned int sample, bool *terminated)
 {
+	float t = (float) sample / (float) this->samplerate;
 	float envelope = instrument_compute_envelope(this, duration, t);
 	if (envelope < 0) {
 		*terminated = true;
 		return 0;
 	}
 
+	if (this->oscillator == INSTRUMENT_OSCILLATOR_PHASOR) {
+		return instrument_compute_phasor(this, sample) * envelope;
+	}
+
+	if (this->oscillator == INSTRUMENT_OSCILLATOR_WAVETABLE) {
+		//Phase in double from the sample index: the cycles count grows
+		//large on long notes
+		double cycles = (double) sample * (double) this->fondamental / (double) this->samplerate;
+		float phase = cycles - floor(cycles);
+		float gain = (float) this->velocity / 127.0;
+		return wavetable_read(this->table, phase) * gain * envelope;
+	}
+
 	float value = 0;
 	for (int j = 0; j < ARRAY_SIZE(this->profile->spectrum); j++) {
 		float gain = this->profile->spectrum[j] * (float) this->velocity / 127.0;
@@ -20,8 +20,36 @@
 
 #include <stdbool.h>
 
+#include "wavetable.h"
+
+#define INSTRUMENT_PARTIALS 20
+
+//The phasor oscillator is resynchronised from exact phases at every
+//multiple of this number of samples to bound the rounding drift
+#define INSTRUMENT_PHASOR_RESYNC 1024
+
+#if defined(__GNUC__)
+typedef float InstrumentVector __attribute__((vector_size(16)));
+#define INSTRUMENT_VECTOR_SIZE 4
+#else
+typedef float InstrumentVector;
+#define INSTRUMENT_VECTOR_SIZE 1
+#endif
+
+#define INSTRUMENT_VECTORS (INSTRUMENT_PARTIALS / INSTRUMENT_VECTOR_SIZE)
+
+//Resolution of the ADSR curve tables
+#define INSTRUMENT_ENVELOPE_STEPS 1024
+
+union instrument_lanes {
+	InstrumentVector v[INSTRUMENT_VECTORS];
+	float f[INSTRUMENT_PARTIALS];
+};
+
+typedef union instrument_lanes InstrumentLanes;
+
 struct instrument_profile {
-	float spectrum[20];
+	float spectrum[INSTRUMENT_PARTIALS];
 
 	//ADSR enveloppe setting
 	float a0;
@@ -33,21 +61,56 @@ struct instrument_profile {
 	float s1;
 	float r0;
 	float r1;
+
+	//Normalised attack, decay and release curves, filled by
+	//instrument_profile_init()
+	bool initialized;
+	float attack[INSTRUMENT_ENVELOPE_STEPS + 1];
+	float decay[INSTRUMENT_ENVELOPE_STEPS + 1];
+	float release[INSTRUMENT_ENVELOPE_STEPS + 1];
 };
 
 typedef struct instrument_profile InstrumentProfile;
 
+enum instrument_oscillator {
+	INSTRUMENT_OSCILLATOR_SINE,
+	INSTRUMENT_OSCILLATOR_WAVETABLE,
+	INSTRUMENT_OSCILLATOR_PHASOR
+};
+
+typedef enum instrument_oscillator InstrumentOscillator;
+
+//One complex rotator per partial, advanced by one sample per step
+struct instrument_phasor {
+	InstrumentLanes re;
+	InstrumentLanes im;
+	InstrumentLanes step_re;
+	InstrumentLanes step_im;
+	InstrumentLanes gain;
+	int vectors;
+	unsigned int next; //sample the rotators are currently at
+};
+
+typedef struct instrument_phasor InstrumentPhasor;
+
 struct instrument {
 	int velocity;
 	float fondamental;
+	unsigned int samplerate;
+	float silence; //envelope level ending the release
 	InstrumentProfile *profile;
+	InstrumentOscillator oscillator;
+	float const *table;
+	InstrumentPhasor phasor;
 };
 
 typedef struct instrument Instrument;
 
-Instrument *instrument_new(float fondamental, int velocity, InstrumentProfile *profile);
-void instrument_free(Instrument *this);
-float instrument_compute(Instrument *this, float duration, float t, bool *terminated);
+void instrument_profile_init(InstrumentProfile *profile);
+void instrument_init(Instrument *this, float fondamental, int velocity, InstrumentProfile *profile, InstrumentOscillator oscillator, Wavetable *wavetable, unsigned int samplerate, float silence);
+float instrument_compute_envelope(Instrument *this, float duration, float t);
+float instrument_compute(Instrument *this, float duration, unsigned int sample, bool *terminated);
+bool instrument_is_terminated(Instrument *this, float duration, unsigned int sample);
 
 extern InstrumentProfile instrument_organ;
 extern InstrumentProfile instrument_harp;
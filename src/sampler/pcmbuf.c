@@ -25,35 +25,67 @@
 
 PcmbufClassDef pcmbuf_u8_def;
 PcmbufClassDef pcmbuf_i16_def;
+PcmbufClassDef pcmbuf_i24_def;
 PcmbufClassDef pcmbuf_i32_def;
+PcmbufClassDef pcmbuf_f32_def;
 
-Pcmbuf *pcmbuf_new(size_t length, size_t sample_size, unsigned int channels)
+size_t pcmbuf_format_get_size(PcmbufFormat format)
+{
+	switch (format) {
+	case PCMBUF_FORMAT_U8:
+		return 1;
+	case PCMBUF_FORMAT_I16:
+		return 2;
+	case PCMBUF_FORMAT_I24:
+		return 3;
+	case PCMBUF_FORMAT_I32:
+	case PCMBUF_FORMAT_F32:
+		return 4;
+	}
+	return 0;
+}
+
+Pcmbuf *pcmbuf_new(size_t capacity, PcmbufFormat format, unsigned int channels)
 {
 	PcmbufClassDef *class_def = NULL;
-	switch (sample_size) {
-	case 1: 
+	switch (format) {
+	case PCMBUF_FORMAT_U8: 
 		class_def = &pcmbuf_u8_def;
 		break;
-	case 2: 
+	case PCMBUF_FORMAT_I16: 
 		class_def = &pcmbuf_i16_def;
 		break;
-	case 4: 
+	case PCMBUF_FORMAT_I24: 
+		class_def = &pcmbuf_i24_def;
+		break;
+	case PCMBUF_FORMAT_I32: 
 		class_def = &pcmbuf_i32_def;
 		break;
+	case PCMBUF_FORMAT_F32: 
+		class_def = &pcmbuf_f32_def;
+		break;
 	default:
 		return NULL;
 	}
+	size_t sample_size = pcmbuf_format_get_size(format);
 
 	Pcmbuf *this = malloc(sizeof(Pcmbuf));
 	if (this == NULL) {
 		return NULL;
 	}
-	this->data = calloc(length, sample_size * channels);
+	this->data = calloc(capacity, sizeof(float) * channels);
 	if (this->data == NULL) {
 		free(this);
 		return NULL;
 	}
-	this->length = length;
+	this->output = malloc(capacity * sample_size * channels);
+	if (this->output == NULL) {
+		free(this->data);
+		free(this);
+		return NULL;
+	}
+	this->capacity = capacity;
+	this->length = capacity;
 	this->sample_size = sample_size;
 	this->channels = channels;
 	this->class_def = class_def;
@@ -62,216 +94,237 @@ Pcmbuf *pcmbuf_new(size_t length, size_t sample_size, unsigned int channels)
 
 void pcmbuf_free(Pcmbuf *this)
 {
+	free(this->output);
 	free(this->data);
 	free(this);
 }
 
-static void *pcmbuf_get_ptr(Pcmbuf *this, unsigned int sample, unsigned int channel)
+int pcmbuf_set_length(Pcmbuf *this, size_t length)
 {
-	if (sample >= this->length || channel >= this->channels) {
-		return NULL;
+	if (length > this->capacity) {
+		return -1;
 	}
-	size_t offset = ((sample * this->channels) + channel) * this->sample_size;
-	return this->data + offset;
+	this->length = length;
+	return 0;
 }
 
-int pcmbuf_set(Pcmbuf *this, unsigned int sample, unsigned int channel, float value)
+void pcmbuf_clear(Pcmbuf *this)
 {
-	void *ptr = pcmbuf_get_ptr(this, sample, channel);
-	if (ptr == NULL) {
-		return -1;
-	}
-
-	if (value > 1) value = 1;
-	if (value < -1) value = -1;
-
-	return this->class_def->set(this, ptr, value);
+	memset(this->data, 0, this->length * this->channels * sizeof(float));
 }
 
-int pcmbuf_inc(Pcmbuf *this, unsigned int sample, unsigned int channel, float value)
+void pcmbuf_mix(Pcmbuf *this, Pcmbuf const *src)
 {
-	void *ptr = pcmbuf_get_ptr(this, sample, channel);
-	if (ptr == NULL) {
-		return -1;
+	size_t count = this->length * this->channels;
+	float *restrict dst = this->data;
+	float const *restrict data = src->data;
+	for (size_t i = 0; i < count; i++) {
+		dst[i] += data[i];
 	}
-
-	return this->class_def->inc(this, ptr, value);
 }
 
-void pcmbuf_clear(Pcmbuf *this)
+//dst must hold length frames in the output format
+void pcmbuf_convert_le(Pcmbuf *this, unsigned char *dst)
 {
-	return this->class_def->clear(this);
+	this->class_def->copy_le(this, this->data, dst, this->length * this->channels);
 }
 
 size_t pcmbuf_fwrite_interlaced_le(Pcmbuf *this, FILE *f)
 {
-	size_t size = this->length * this->sample_size * this->channels;
-	char *buffer = malloc(size);
-	if (buffer == NULL) {
-		return -1;
-	}
+	size_t size = this->length * this->channels * this->sample_size;
 
-	size_t offset = 0;
-	int ret = -1;
-	for (size_t i = 0; i < this->length; i++) {
-		for (unsigned int j = 0; j < this->channels; j++) {
-			void *src = pcmbuf_get_ptr(this, i, j);
-			if (src == NULL) {
-				goto exit;
-			}
-			if (this->class_def->copy_le(this, src, buffer + offset) != 0) {
-				goto exit;
-			}
-			offset += this->sample_size;
-		}
-	}
+	pcmbuf_convert_le(this, this->output);
 
-	if (fwrite(buffer, 1, size, f) != size) {
-		goto exit;
+	if (fwrite(this->output, 1, size, f) != size) {
+		return -1;
 	}
-	ret = 0;
-exit:
-	free(buffer);
-	return ret;
+	return 0;
 }
 
-//------------- 8 bits PCM
-
-#define U8_NEUTRAL 128
-#define U8_AMPLITUDE 127
-#define U8_MIN 0
-#define U8_MAX 255
-
-int pcmbuf_u8_set(Pcmbuf *this, uint8_t *ptr, float value)
+inline static float pcmbuf_clip(float value)
 {
-	*ptr = U8_NEUTRAL + roundf(value * (float) U8_AMPLITUDE);
-	return 0;
+	if (value > 1) value = 1;
+	if (value < -1) value = -1;
+	return value;
 }
 
-float pcmbuf_u8_get(Pcmbuf *this, uint8_t *ptr)
+//Vector kernels convert PCMBUF_LANES samples at once and store them as
+//they are in memory, so they are only used on little endian hosts. The
+//remaining samples go through the scalar loops.
+#if defined(__GNUC__) && __GNUC__ >= 9 && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PCMBUF_VECTORS
+
+#define PCMBUF_LANES 4
+
+typedef float PcmbufFloats __attribute__((vector_size(PCMBUF_LANES * 4)));
+typedef double PcmbufDoubles __attribute__((vector_size(PCMBUF_LANES * 8)));
+typedef int32_t PcmbufInts __attribute__((vector_size(PCMBUF_LANES * 4)));
+typedef int64_t PcmbufLongs __attribute__((vector_size(PCMBUF_LANES * 8)));
+typedef int16_t PcmbufShorts __attribute__((vector_size(PCMBUF_LANES * 2)));
+typedef uint8_t PcmbufBytes __attribute__((vector_size(PCMBUF_LANES)));
+
+inline static PcmbufFloats pcmbuf_load(float const *src)
 {
-	return ((float) (*ptr) - (float) U8_NEUTRAL) / (float) U8_AMPLITUDE;
+	PcmbufFloats v;
+	memcpy(&v, src, sizeof(v));
+	return v;
 }
 
-int pcmbuf_u8_copy(Pcmbuf *this, uint8_t *ptr, unsigned char *dst)
+inline static PcmbufFloats pcmbuf_vector_clip(PcmbufFloats v)
 {
-	*dst = *ptr;
-	return 0;
+	PcmbufFloats one = (PcmbufFloats) {} + 1.0f;
+	//Comparisons give all bits set in the lanes where they hold
+	PcmbufInts above = v > one;
+	PcmbufInts below = v < -one;
+	PcmbufInts bits = (PcmbufInts) v & ~(above | below);
+	bits |= ((PcmbufInts) one & above) | ((PcmbufInts) -one & below);
+	return (PcmbufFloats) bits;
 }
 
-int pcmbuf_u8_inc(Pcmbuf *this, uint8_t *ptr, float value)
+//Same as roundf(), halfway cases away from zero. The conversion
+//truncates and the fraction left is exact.
+inline static PcmbufInts pcmbuf_vector_round(PcmbufFloats v)
 {
-	int i = *ptr + roundf(value * (float) U8_AMPLITUDE);
-	if (i > U8_MAX) i = U8_MAX;
-	if (i < U8_MIN) i = U8_MIN;
-	*ptr = i;
-	return 0;
+	PcmbufFloats half = (PcmbufFloats) {} + 0.5f;
+	PcmbufInts i = __builtin_convertvector(v, PcmbufInts);
+	PcmbufFloats frac = v - __builtin_convertvector(i, PcmbufFloats);
+	return i - (frac >= half) + (frac <= -half);
 }
+#endif
+
+//------------- 8 bits PCM
+
+#define U8_NEUTRAL 128
+#define U8_AMPLITUDE 127
 
-int pcmbuf_u8_clear(Pcmbuf *this, uint8_t *ptr, float value)
+void pcmbuf_u8_copy(Pcmbuf *this, float const *src, unsigned char *dst, size_t count)
 {
-	memset(this->data, U8_NEUTRAL, this->length * this->sample_size * this->channels);
+	size_t i = 0;
+#ifdef PCMBUF_VECTORS
+	for (; i + PCMBUF_LANES <= count; i += PCMBUF_LANES) {
+		PcmbufFloats v = pcmbuf_vector_clip(pcmbuf_load(src + i)) * (float) U8_AMPLITUDE;
+		PcmbufBytes u8 = __builtin_convertvector(pcmbuf_vector_round(v) + U8_NEUTRAL, PcmbufBytes);
+		memcpy(dst + i, &u8, sizeof(u8));
+	}
+#endif
+	for (; i < count; i++) {
+		dst[i] = U8_NEUTRAL + (int) roundf(pcmbuf_clip(src[i]) * (float) U8_AMPLITUDE);
+	}
 }
 
 PcmbufClassDef pcmbuf_u8_def = {
-	.set = (PcmbufSetCB) pcmbuf_u8_set,
-	.inc = (PcmbufIncCB) pcmbuf_u8_inc,
-	.get = (PcmbufGetCB) pcmbuf_u8_get,
-	.copy_le = (PcmbufCopyCB) pcmbuf_u8_copy,
-	.clear = (PcmbufClearCB) pcmbuf_u8_clear
+	.copy_le = (PcmbufCopyCB) pcmbuf_u8_copy
 };
 
 //------------- 16 bits PCM
 
 #define I16_MAX 0x7fff
-#define I16_MIN (-I16_MAX)
 
-int pcmbuf_i16_set(Pcmbuf *this, int16_t *ptr, float value)
+void pcmbuf_i16_copy_le(Pcmbuf *this, float const *src, unsigned char *dst, size_t count)
 {
-	*ptr = roundf(value * I16_MAX);
-	return 0;
+	size_t i = 0;
+#ifdef PCMBUF_VECTORS
+	for (; i + PCMBUF_LANES <= count; i += PCMBUF_LANES) {
+		PcmbufFloats v = pcmbuf_vector_clip(pcmbuf_load(src + i)) * (float) I16_MAX;
+		PcmbufShorts i16 = __builtin_convertvector(pcmbuf_vector_round(v), PcmbufShorts);
+		memcpy(dst + 2 * i, &i16, sizeof(i16));
+	}
+#endif
+	for (; i < count; i++) {
+		int16_t i16 = roundf(pcmbuf_clip(src[i]) * (float) I16_MAX);
+		dst[2 * i + 0] = (i16 >> 0) & 0xff;
+		dst[2 * i + 1] = (i16 >> 8) & 0xff;
+	}
 }
 
-float pcmbuf_i16_get(Pcmbuf *this, int16_t *ptr)
-{
-	return (float) (*ptr) / (float) I16_MAX;
-}
+PcmbufClassDef pcmbuf_i16_def = {
+	.copy_le = (PcmbufCopyCB) pcmbuf_i16_copy_le
+};
 
-int pcmbuf_i16_copy_le(Pcmbuf *this, int32_t *ptr, unsigned char *dst)
-{
-	int16_t i16 = *ptr;
-	dst[0] = (i16 >> 0) & 0xff;
-	dst[1] = (i16 >> 8) & 0xff;
-	return 0;
-}
+//------------- 24 bits PCM, packed
 
-int pcmbuf_i16_inc(Pcmbuf *this, int16_t *ptr, float value)
-{
-	int i = *ptr + roundf(value * (float) I16_MAX);
-	if (i > I16_MAX) i = I16_MAX;
-	if (i < I16_MIN) i = I16_MIN;
-	*ptr = i;
-	return 0;
-}
+#define I24_MAX 0x7fffff
 
-int pcmbuf_i16_clear(Pcmbuf *this, uint8_t *ptr, float value)
+void pcmbuf_i24_copy_le(Pcmbuf *this, float const *src, unsigned char *dst, size_t count)
 {
-	bzero(this->data, this->length * this->sample_size * this->channels);
+	size_t i = 0;
+#ifdef PCMBUF_VECTORS
+	for (; i + PCMBUF_LANES <= count; i += PCMBUF_LANES) {
+		PcmbufFloats v = pcmbuf_vector_clip(pcmbuf_load(src + i)) * (float) I24_MAX;
+		PcmbufInts i24 = pcmbuf_vector_round(v);
+		//Drop the high byte of each lane
+		unsigned char *out = dst + 3 * i;
+		for (int j = 0; j < PCMBUF_LANES; j++) {
+			memcpy(out + 3 * j, (unsigned char *) &i24 + 4 * j, 3);
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		int32_t i24 = roundf(pcmbuf_clip(src[i]) * (float) I24_MAX);
+		dst[3 * i + 0] = (i24 >> 0) & 0xff;
+		dst[3 * i + 1] = (i24 >> 8) & 0xff;
+		dst[3 * i + 2] = (i24 >> 16) & 0xff;
+	}
 }
 
-PcmbufClassDef pcmbuf_i16_def = {
-	.set = (PcmbufSetCB) pcmbuf_i16_set,
-	.inc = (PcmbufIncCB) pcmbuf_i16_inc,
-	.get = (PcmbufGetCB) pcmbuf_i16_get,
-	.copy_le = (PcmbufCopyCB) pcmbuf_i16_copy_le,
-	.clear = (PcmbufClearCB) pcmbuf_i16_clear
+PcmbufClassDef pcmbuf_i24_def = {
+	.copy_le = (PcmbufCopyCB) pcmbuf_i24_copy_le
 };
 
 //------------- 32 bits PCM
 
 #define I32_MAX (0x7fffffff)
-#define I32_MIN (-I32_MAX)
 
-int pcmbuf_i32_set(Pcmbuf *this, int32_t *ptr, float value)
+void pcmbuf_i32_copy_le(Pcmbuf *this, float const *src, unsigned char *dst, size_t count)
 {
-	*ptr = roundf(value * I32_MAX);
-	return 0;
-}
-
-float pcmbuf_i32_get(Pcmbuf *this, int32_t *ptr)
-{
-	return (float) (*ptr) / (float) I32_MAX;
+	size_t i = 0;
+#ifdef PCMBUF_VECTORS
+	for (; i + PCMBUF_LANES <= count; i += PCMBUF_LANES) {
+		PcmbufFloats v = pcmbuf_vector_clip(pcmbuf_load(src + i));
+		//Rounded in double as the scalar loop, kept inline: double
+		//vectors are wider than the SSE registers
+		PcmbufDoubles d = __builtin_convertvector(v, PcmbufDoubles) * (double) I32_MAX;
+		PcmbufDoubles half = (PcmbufDoubles) {} + 0.5;
+		PcmbufLongs l = __builtin_convertvector(d, PcmbufLongs);
+		PcmbufDoubles frac = d - __builtin_convertvector(l, PcmbufDoubles);
+		l = l - (frac >= half) + (frac <= -half);
+		PcmbufInts i32 = __builtin_convertvector(l, PcmbufInts);
+		memcpy(dst + 4 * i, &i32, sizeof(i32));
+	}
+#endif
+	for (; i < count; i++) {
+		//In double: I32_MAX is not representable as a float
+		int32_t i32 = round((double) pcmbuf_clip(src[i]) * (double) I32_MAX);
+		dst[4 * i + 0] = (i32 >> 0) & 0xff;
+		dst[4 * i + 1] = (i32 >> 8) & 0xff;
+		dst[4 * i + 2] = (i32 >> 16) & 0xff;
+		dst[4 * i + 3] = (i32 >> 24) & 0xff;
+	}
 }
 
-int pcmbuf_i32_copy_le(Pcmbuf *this, int32_t *ptr, unsigned char *dst)
-{
-	int32_t i32 = *ptr;
-	dst[0] = (i32 >> 0) & 0xff;
-	dst[1] = (i32 >> 8) & 0xff;
-	dst[2] = (i32 >> 16) & 0xff;
-	dst[3] = (i32 >> 24) & 0xff;
-	return 0;
-}
+PcmbufClassDef pcmbuf_i32_def = {
+	.copy_le = (PcmbufCopyCB) pcmbuf_i32_copy_le
+};
 
-int pcmbuf_i32_inc(Pcmbuf *this, int32_t *ptr, float value)
-{
-	int i = *ptr + roundf(value * (float) I32_MAX);
-	if (i > I32_MAX) i = I32_MAX;
-	if (i < I32_MIN) i = I32_MIN;
-	*ptr = i;
-	return 0;
-}
+//------------- 32 bits IEEE float
 
-int pcmbuf_i32_clear(Pcmbuf *this, uint8_t *ptr, float value)
+//The mix bus is written as it is, without clipping
+void pcmbuf_f32_copy_le(Pcmbuf *this, float const *src, unsigned char *dst, size_t count)
 {
-	bzero(this->data, this->length * this->sample_size * this->channels);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(dst, src, count * sizeof(float));
+#else
+	for (size_t i = 0; i < count; i++) {
+		uint32_t f32;
+		memcpy(&f32, src + i, sizeof(f32));
+		dst[4 * i + 0] = (f32 >> 0) & 0xff;
+		dst[4 * i + 1] = (f32 >> 8) & 0xff;
+		dst[4 * i + 2] = (f32 >> 16) & 0xff;
+		dst[4 * i + 3] = (f32 >> 24) & 0xff;
+	}
+#endif
 }
 
-PcmbufClassDef pcmbuf_i32_def = {
-	.set = (PcmbufSetCB) pcmbuf_i32_set,
-	.inc = (PcmbufIncCB) pcmbuf_i32_inc,
-	.get = (PcmbufGetCB) pcmbuf_i32_get,
-	.copy_le = (PcmbufCopyCB) pcmbuf_i32_copy_le,
-	.clear = (PcmbufClearCB) pcmbuf_i32_clear
+PcmbufClassDef pcmbuf_f32_def = {
+	.copy_le = (PcmbufCopyCB) pcmbuf_f32_copy_le
 };
-
@@ -24,39 +24,52 @@
 struct pcmbuf;
 typedef struct pcmbuf Pcmbuf;
 
-typedef int (*PcmbufSetCB)(Pcmbuf *this, void *ptr, float value);
-typedef int (*PcmbufIncCB)(Pcmbuf *this, void *ptr, float value);
-typedef float (*PcmbufGetCB)(Pcmbuf *this, void *ptr);
-typedef int (*PcmbufCopyCB)(Pcmbuf *this, void *ptr, unsigned char *dst);
-typedef void (*PcmbufClearCB)(Pcmbuf *this);
+enum pcmbuf_format {
+	PCMBUF_FORMAT_U8,
+	PCMBUF_FORMAT_I16,
+	PCMBUF_FORMAT_I24,
+	PCMBUF_FORMAT_I32,
+	PCMBUF_FORMAT_F32
+};
+
+typedef enum pcmbuf_format PcmbufFormat;
+
+//Convert count float samples to the output format, little endian
+typedef void (*PcmbufCopyCB)(Pcmbuf *this, float const *src, unsigned char *dst, size_t count);
 
 struct pcmbuf_class_def {
-	PcmbufSetCB set;
-	PcmbufGetCB get;
 	PcmbufCopyCB copy_le;
-	PcmbufIncCB inc;
-	PcmbufClearCB clear;
 };
 
 typedef struct pcmbuf_class_def PcmbufClassDef;
 
+//Interleaved float mix bus: voices are summed here at full precision and
+//the result is only clipped and converted to the output sample size when
+//written
 struct pcmbuf {
 	PcmbufClassDef *class_def;
 	
-	size_t length;
+	size_t capacity;
+	size_t length; //frames in use, up to capacity
 	size_t sample_size;
-	float max_value;
 	unsigned int channels;
-	void *data;
+	float *data;
+	unsigned char *output; //conversion buffer, reused by every write
 };
 
 
-Pcmbuf *pcmbuf_new(size_t length, size_t sample_size, unsigned int channels);
+size_t pcmbuf_format_get_size(PcmbufFormat format);
+Pcmbuf *pcmbuf_new(size_t capacity, PcmbufFormat format, unsigned int channels);
 void pcmbuf_free(Pcmbuf *this);
-int pcmbuf_set(Pcmbuf *this, unsigned int sample, unsigned int channel, float value);
-int pcmbuf_inc(Pcmbuf *this, unsigned int sample, unsigned int channel, float value);
+int pcmbuf_set_length(Pcmbuf *this, size_t length);
 void pcmbuf_clear(Pcmbuf *this);
+void pcmbuf_mix(Pcmbuf *this, Pcmbuf const *src);
+void pcmbuf_convert_le(Pcmbuf *this, unsigned char *dst);
 size_t pcmbuf_fwrite_interlaced_le(Pcmbuf *this, FILE *f);
 
-#endif
+inline static float *pcmbuf_get_frame(Pcmbuf *this, unsigned int sample)
+{
+	return this->data + sample * this->channels;
+}
 
+#endif
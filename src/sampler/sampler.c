@@ -20,18 +20,36 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <limits.h>
 
 #include <common.h>
+#include <threadpool.h>
 
 #include "sampler_event.h"
+#include "sampler_pool.h"
 #include "pcmbuf.h"
 #include "codec_wav.h"
 
 PlayerEngineClassDef sampler_engine_class_def;
 
-Sampler *sampler_new(float gain, bool autopan, CodecWav *codec_wav, Temperament *temperament)
+void sampler_show_progress(Sampler *this);
+
+static int sampler_init_voices(Sampler *this, int max_voices)
+{
+	this->voice_pool = sampler_pool_new(max_voices);
+	if (this->voice_pool == NULL) {
+		return -1;
+	}
+	this->voices = malloc(max_voices * sizeof(SamplerEvent *));
+	if (this->voices == NULL) {
+		return -1;
+	}
+	return 0;
+}
+
+Sampler *sampler_new(float gain, bool autopan, InstrumentOscillator oscillator, SamplerLimits const *limits, int threads, int render_jobs, CodecWav *codec_wav, Temperament *temperament)
 {
-	Sampler *this = malloc(sizeof(Sampler));
+	Sampler *this = calloc(1, sizeof(Sampler));
 	if (this == NULL) {
 		return NULL;
 	}
@@ -44,22 +62,123 @@ Sampler *sampler_new(float gain, bool autopan, CodecWav *codec_wav, Temperament
 	this->autopan = autopan;
 	this->codec_wav = codec_wav;
 	this->temperament = temperament;
-	this->events = list_new();
+	this->oscillator = oscillator;
+	this->threads = threads;
+	this->render_jobs = render_jobs;
+	instrument_profile_init(&instrument_piano);
+
+	this->limits = *limits;
+	if (this->limits.polyphony < 1 || this->limits.polyphony > limits->max_voices) {
+		this->limits.polyphony = limits->max_voices;
+	}
+	if (sampler_init_voices(this, limits->max_voices) != 0) {
+		goto error;
+	}
+
+	//Shard 0 renders straight into the output block
+	this->shards = calloc(threads, sizeof(Pcmbuf *));
+	if (this->shards == NULL) {
+		goto error;
+	}
+	for (int i = 0; i < threads; i++) {
+		this->shards[i] = pcmbuf_new(SAMPLER_BLOCK_SIZE, codec_wav->format, codec_wav->channels);
+		if (this->shards[i] == NULL) {
+			goto error;
+		}
+	}
+	this->pcmbuf = this->shards[0];
+
+	if (threads > 1) {
+		this->pool = threadpool_new(threads);
+		if (this->pool == NULL) {
+			goto error;
+		}
+	}
+
+	if (oscillator == INSTRUMENT_OSCILLATOR_WAVETABLE) {
+		InstrumentProfile *profile = &instrument_piano;
+		this->wavetable = wavetable_new(profile->spectrum, ARRAY_SIZE(profile->spectrum), this->samplerate);
+		if (this->wavetable == NULL) {
+			goto error;
+		}
+	}
 	return this;
+
+error:
+	sampler_free(this);
+	return NULL;
+}
+
+//Single threaded copy rendering one segment, tables are shared with the
+//parent
+static Sampler *sampler_new_segment(Sampler *parent, SamplerSegment *segment)
+{
+	Sampler *this = calloc(1, sizeof(Sampler));
+	if (this == NULL) {
+		return NULL;
+	}
+
+	this->class_def = parent->class_def;
+	this->position = 0;
+	this->samplerate = parent->samplerate;
+	this->gain = parent->gain;
+	this->autopan = parent->autopan;
+	this->codec_wav = parent->codec_wav;
+	this->temperament = parent->temperament;
+	this->oscillator = parent->oscillator;
+	this->wavetable = parent->wavetable;
+	this->threads = 1;
+	this->segment = segment;
+
+	this->limits = parent->limits;
+	if (sampler_init_voices(this, this->limits.max_voices) != 0) {
+		goto error;
+	}
+
+	this->shards = calloc(1, sizeof(Pcmbuf *));
+	if (this->shards == NULL) {
+		goto error;
+	}
+	this->shards[0] = pcmbuf_new(SAMPLER_BLOCK_SIZE, this->codec_wav->format, this->codec_wav->channels);
+	if (this->shards[0] == NULL) {
+		goto error;
+	}
+	this->pcmbuf = this->shards[0];
+	return this;
+
+error:
+	sampler_free(this);
+	return NULL;
 }
 
 void sampler_free(Sampler *this)
 {
-	list_free(this->events, (ListFreeCB) sampler_event_free);
+	if (this->voice_pool != NULL) {
+		sampler_pool_free(this->voice_pool);
+	}
+	free(this->voices);
+	if (this->wavetable != NULL && this->segment == NULL) {
+		wavetable_free(this->wavetable);
+	}
+	if (this->pool != NULL) {
+		threadpool_free(this->pool);
+	}
+	if (this->shards != NULL) {
+		for (int i = 0; i < this->threads; i++) {
+			if (this->shards[i] != NULL) {
+				pcmbuf_free(this->shards[i]);
+			}
+		}
+		free(this->shards);
+	}
 	free(this);
 }
 
 void sampler_debug(Sampler *this)
 {
-	ListNode *node;
-	LIST_FOREACH(this->events, node) {
-		SamplerEvent *event = (SamplerEvent *) node->item;
-		if (node != this->events->first) {
+	for (int i = 0; i < this->nvoices; i++) {
+		SamplerEvent *event = this->voices[i];
+		if (i > 0) {
 			printf(", ");
 		}
 		printf("ch%02d:%03d", event->channel, event->note);
@@ -67,11 +186,21 @@ void sampler_debug(Sampler *this)
 	printf("\n");
 }
 
+inline static bool sampler_is_indexed(int channel, int note)
+{
+	return channel >= 0 && channel < SAMPLER_CHANNELS && note >= 0 && note < SAMPLER_NOTES;
+}
+
+//Held voice, the index covers the MIDI range, transposed notes out of it
+//are looked up among the active voices
 SamplerEvent *sampler_find_event(Sampler *this, int channel, int note)
 {
-	ListNode *node;
-	LIST_FOREACH(this->events, node) {
-		SamplerEvent *event = (SamplerEvent *) node->item;
+	if (sampler_is_indexed(channel, note) == true) {
+		return this->held[channel][note];
+	}
+
+	for (int i = 0; i < this->nvoices; i++) {
+		SamplerEvent *event = this->voices[i];
 		if (event->channel == channel && event->note == note && event->ending == false) {
 			return event;
 		}
@@ -79,6 +208,75 @@ SamplerEvent *sampler_find_event(Sampler *this, int channel, int note)
 	return NULL;
 }
 
+static void sampler_add_voice(Sampler *this, SamplerEvent *event)
+{
+	this->voices[this->nvoices++] = event;
+	if (sampler_is_indexed(event->channel, event->note) == true) {
+		this->held[event->channel][event->note] = event;
+	}
+}
+
+//Drop the terminated voices. The remaining ones keep their order, which
+//is the order they are mixed in: the output does not depend on when
+//voices are retired.
+static void sampler_retire_voices(Sampler *this)
+{
+	int count = 0;
+	for (int i = 0; i < this->nvoices; i++) {
+		SamplerEvent *event = this->voices[i];
+		if (event->terminated == true) {
+			//Voices only end after their note off, they are not held
+			sampler_pool_put(this->voice_pool, event);
+		}
+		else {
+			this->voices[count++] = event;
+		}
+	}
+	this->nvoices = count;
+}
+
+//Voice to cut to make room for a note on
+static SamplerEvent *sampler_find_victim(Sampler *this, int channel, int note)
+{
+	switch (this->limits.steal) {
+		case SAMPLER_STEAL_SAME_NOTE:
+			//The same note still ringing, or else the oldest voice
+			for (int i = 0; i < this->nvoices; i++) {
+				SamplerEvent *event = this->voices[i];
+				if (event->channel == channel && event->note == note) {
+					return event;
+				}
+			}
+			break;
+		case SAMPLER_STEAL_QUIETEST: {
+			SamplerEvent *victim = NULL;
+			float min = INFINITY;
+			for (int i = 0; i < this->nvoices; i++) {
+				float level = sampler_event_get_level(this->voices[i], this->position);
+				if (level < min) {
+					min = level;
+					victim = this->voices[i];
+				}
+			}
+			return victim;
+		}
+		case SAMPLER_STEAL_OLDEST:
+			break;
+	}
+	//Voices are kept in note on order
+	return this->voices[0];
+}
+
+static void sampler_steal_voice(Sampler *this, int channel, int note)
+{
+	SamplerEvent *event = sampler_find_victim(this, channel, note);
+	if (event->ending == false && sampler_is_indexed(event->channel, event->note) == true) {
+		this->held[event->channel][event->note] = NULL;
+	}
+	event->terminated = true;
+	sampler_retire_voices(this);
+}
+
 int sampler_set_note(Sampler *this, int channel, int note, int velocity, bool state)
 {
 //	printf("channel: %d, note: %d, velocity: %d, state: %s\n", channel, note, velocity, state ? "on" : "off");
@@ -89,15 +287,26 @@ int sampler_set_note(Sampler *this, int channel, int note, int velocity, bool st
 			return -1;
 		}
 
+		if (this->nvoices >= this->limits.polyphony) {
+			sampler_steal_voice(this, channel, note);
+		}
+		event = sampler_pool_get(this->voice_pool);
+		if (event == NULL) {
+			return -1;
+		}
+
 		float pan = this->autopan == true ? (float) note / 127.0 : -1.0;
-		event = sampler_event_new(this, this->position, channel, note, velocity, this->gain, pan);
-		list_append(this->events, (ListItem *) event);
+		sampler_event_init(event, this, this->position, channel, note, velocity, this->gain, pan);
+		sampler_add_voice(this, event);
 	}
 	else {
 		if (event == NULL) {
 			return -1;
 		}
 		sampler_event_set_end(event, this->position);
+		if (sampler_is_indexed(channel, note) == true) {
+			this->held[channel][note] = NULL;
+		}
 	}
 
 //	sampler_debug(this);
@@ -109,38 +318,230 @@ int sampler_open(Sampler *this)
 	return codec_wav_open(this->codec_wav);
 }
 
-void sampler_wait(Sampler *this, useconds_t usec)
+//Shard n renders the voices n, n + threads, n + 2 * threads...
+static void sampler_render_shard(Sampler *this, int shard)
+{
+	Pcmbuf *pcmbuf = this->shards[shard];
+	pcmbuf_clear(pcmbuf);
+
+	for (int i = shard; i < this->nvoices; i += this->threads) {
+		sampler_event_render(this->voices[i], this->position, pcmbuf);
+	}
+}
+
+static int sampler_render_block(Sampler *this, unsigned int length)
+{
+	Pcmbuf *pcmbuf = this->pcmbuf;
+	pcmbuf_set_length(pcmbuf, length);
+
+	//Shards without voices would only add zeroes
+	int shards = this->nvoices < this->threads ? this->nvoices : this->threads;
+
+	//Set before the tasks start, they only read it. shards[0] is pcmbuf.
+	for (int i = 1; i < shards; i++) {
+		pcmbuf_set_length(this->shards[i], length);
+	}
+	if (this->pool != NULL && shards > 1) {
+		threadpool_run(this->pool, (ThreadpoolTask) sampler_render_shard, this, shards);
+	}
+	else if (shards > 0) {
+		for (int i = 0; i < shards; i++) {
+			sampler_render_shard(this, i);
+		}
+	}
+	else {
+		pcmbuf_clear(pcmbuf);
+	}
+
+	//Fixed reduction order keeps the output independent of scheduling
+	for (int i = 1; i < shards; i++) {
+		pcmbuf_mix(pcmbuf, this->shards[i]);
+	}
+
+	sampler_retire_voices(this);
+	this->position += length;
+
+	if (this->segment != NULL) {
+		this->segment->length += length;
+		if (pcmbuf_fwrite_interlaced_le(pcmbuf, this->segment->f) != 0) {
+			this->segment->ret = -1;
+			return -1;
+		}
+		return 0;
+	}
+	return codec_wav_write_pcmbuf(this->codec_wav, pcmbuf);
+}
+
+//Advance without rendering, dropping the voices that would have ended
+static void sampler_skip(Sampler *this, unsigned int length)
+{
+	this->position += length;
+
+	for (int i = 0; i < this->nvoices; i++) {
+		SamplerEvent *event = this->voices[i];
+		if (sampler_event_is_terminated(event, this->position - 1) == true) {
+			event->terminated = true;
+		}
+	}
+	sampler_retire_voices(this);
+}
+
+//Returns 1 once the end of the segment is reached, -1 once the output
+//could not be written
+int sampler_wait(Sampler *this, useconds_t usec)
 {
 	unsigned int length = roundf((double) usec * (double) this->samplerate / 1000000.0);
 
-	Pcmbuf *pcmbuf = pcmbuf_new(length, this->codec_wav->sample_size, this->codec_wav->channels);
-	if (pcmbuf == NULL) {
+	SamplerSegment *segment = this->segment;
+	if (segment != NULL) {
+		if (this->position < segment->start) {
+			unsigned int skip = segment->start - this->position;
+			if (skip > length) {
+				skip = length;
+			}
+			sampler_skip(this, skip);
+			length -= skip;
+		}
+		if (length > segment->end - this->position) {
+			length = segment->end - this->position;
+		}
+	}
+
+	while (length > 0) {
+		unsigned int block = length < SAMPLER_BLOCK_SIZE ? length : SAMPLER_BLOCK_SIZE;
+		if (sampler_render_block(this, block) != 0) {
+			return -1;
+		}
+		length -= block;
+	}
+
+	if (segment != NULL && this->position >= segment->end) {
+		return 1;
+	}
+	return 0;
+}
+
+struct sampler_render_ctx {
+	Sampler *sampler;
+	SamplerSegment *segments;
+	PlayerEngineReplayCB replay;
+	void *replay_ctx;
+};
+
+static void sampler_render_segment(struct sampler_render_ctx *ctx, int index)
+{
+	SamplerSegment *segment = &ctx->segments[index];
+	segment->ret = -1;
+
+	Sampler *sampler = sampler_new_segment(ctx->sampler, segment);
+	if (sampler == NULL) {
+		return;
+	}
+	segment->f = open_memstream(&segment->data, &segment->size);
+	if (segment->f == NULL) {
+		sampler_free(sampler);
 		return;
 	}
-	pcmbuf_clear(pcmbuf);
 
-	ListNode *node;
-	ListNode *next;
-	for(node = this->events->first; node != NULL; node = next) {
-		next = node->next;
+	segment->ret = 0;
+	if (ctx->replay(ctx->replay_ctx, (PlayerEngine *) sampler) != 0) {
+		segment->ret = -1;
+	}
+	//The timeline ended inside the segment
+	if (sampler->position < segment->end) {
+		sampler_wait(sampler, SAMPLER_TAIL_USEC);
+	}
 
-		SamplerEvent *event = (SamplerEvent *) node->item;
-		sampler_event_render(event, this->position, pcmbuf);
+	if (fclose(segment->f) != 0) {
+		segment->ret = -1;
+	}
+	segment->f = NULL;
+	sampler_free(sampler);
+}
 
-		if (event->terminated == true) {
-			sampler_event_free(event);
-			list_remove(this->events, (ListItem *) event);
+//Segments are only rendered in parallel with render jobs
+bool sampler_can_render(Sampler *this)
+{
+	return this->render_jobs > 0;
+}
+
+//Split the output in segments rendered in parallel, each worker replays
+//the timeline from the start on its own copy of the sampler. Output is
+//identical to a single threaded render.
+int sampler_render(Sampler *this, int64_t duration, PlayerEngineReplayCB replay, void *ctx)
+{
+	if (this->render_jobs < 1) {
+		return 1;
+	}
+
+	unsigned int segment_length = SAMPLER_SEGMENT_SECONDS * this->samplerate;
+	double length = (double) (duration + SAMPLER_TAIL_USEC) * (double) this->samplerate / 1000000.0;
+	//The last segment is unbounded, the length is only an estimate
+	int nsegments = length / segment_length + 1;
+
+	int jobs = this->render_jobs;
+	Threadpool *pool = threadpool_new(jobs);
+	if (pool == NULL) {
+		return -1;
+	}
+	SamplerSegment *segments = calloc(jobs, sizeof(SamplerSegment));
+	if (segments == NULL) {
+		threadpool_free(pool);
+		return -1;
+	}
+
+	struct sampler_render_ctx render = {
+		.sampler = this,
+		.segments = segments,
+		.replay = replay,
+		.replay_ctx = ctx
+	};
+
+	int ret = 0;
+	//Rounds of one segment per job bound the memory in use
+	for (int first = 0; first < nsegments && ret == 0 && sig_int == false; first += jobs) {
+		int count = nsegments - first < jobs ? nsegments - first : jobs;
+		for (int i = 0; i < count; i++) {
+			SamplerSegment *segment = &segments[i];
+			segment->start = (first + i) * segment_length;
+			segment->end = first + i == nsegments - 1
+				? UINT_MAX
+				: segment->start + segment_length;
+			segment->data = NULL;
+			segment->size = 0;
+			segment->length = 0;
+		}
+
+		threadpool_run(pool, (ThreadpoolTask) sampler_render_segment, &render, count);
+
+		for (int i = 0; i < count; i++) {
+			SamplerSegment *segment = &segments[i];
+			if (ret == 0 && segment->ret == 0) {
+				if (codec_wav_write(this->codec_wav, segment->data, segment->length) != 0) {
+					ret = -1;
+				}
+				this->position += segment->length;
+			}
+			else {
+				ret = -1;
+			}
+			free(segment->data);
 		}
+		sampler_show_progress(this);
 	}
-	this->position += length;
 
-	codec_wav_write_pcmbuf(this->codec_wav, pcmbuf);
-	pcmbuf_free(pcmbuf);
+	free(segments);
+	threadpool_free(pool);
+	this->rendered = true;
+	return ret;
 }
 
 int sampler_close(Sampler *this)
 {
-	sampler_wait(this, 1000000);
+	//The tail is part of the last segment
+	if (this->rendered == false) {
+		sampler_wait(this, SAMPLER_TAIL_USEC);
+	}
 	return codec_wav_close(this->codec_wav);
 }
 
@@ -148,9 +549,24 @@ void sampler_info(Sampler *this)
 {
 	temperament_info(this->temperament);
 	printf("Gain: %.0f%%\n", this->gain * 100.0);
+	char const *steal[] = { "oldest", "quietest", "same-note" };
+	printf("Polyphony: %d, steal %s\n", this->limits.polyphony, steal[this->limits.steal]);
+	if (this->limits.threshold > 0) {
+		printf("Release threshold: %.0f dB\n", 20.0 * log10f(this->limits.threshold));
+	}
+	if (this->render_jobs > 0) {
+		printf("Render jobs: %d, %d seconds segments\n", this->render_jobs, SAMPLER_SEGMENT_SECONDS);
+	}
+	else {
+		printf("Render threads: %d\n", this->threads);
+	}
+	char const *oscillators[] = { "sine", "wavetable", "phasor" };
+	printf("Oscillator: %s\n", oscillators[this->oscillator]);
 	printf("Samplerate: %d hz\n", this->samplerate);
-	printf("Samples size: %d bits\n", this->codec_wav->sample_size * 8);
+	printf("Samples size: %d bits%s\n", this->codec_wav->sample_size * 8,
+		this->codec_wav->format == PCMBUF_FORMAT_F32 ? " float" : "");
 	printf("Channels: %d\n", this->codec_wav->channels);
+	printf("Output format: %s\n", this->codec_wav->container == CODEC_WAV_CONTAINER_RAW ? "raw" : "wav");
 	if (this->codec_wav->channels == 2) {
 		printf("Autopan: %s\n", this->autopan == true ? "on" : "off");
 	}
@@ -162,6 +578,10 @@ void sampler_show_progress_open(Sampler *this)
 
 void sampler_show_progress(Sampler *this)
 {
+	if (this->segment != NULL) {
+		return;
+	}
+
 	printf("Processing... ");
 	int sec = (int) round(this->position / this->samplerate);
 	int s = sec % 60;
@@ -191,5 +611,7 @@ PlayerEngineClassDef sampler_engine_class_def = {
 	.info = (PlayerEngineInfo) sampler_info,
 	.show_progress_open = (PlayerEngineShowProgressOpen) sampler_show_progress_open,
 	.show_progress = (PlayerEngineShowProgress) sampler_show_progress,
-	.show_progress_close = (PlayerEngineShowProgressClose) sampler_show_progress_close
+	.show_progress_close = (PlayerEngineShowProgressClose) sampler_show_progress_close,
+	.render = (PlayerEngineRender) sampler_render,
+	.can_render = (PlayerEngineCanRender) sampler_can_render
 };
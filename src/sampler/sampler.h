@@ -22,9 +22,57 @@
 
 #include <player_engine.h>
 #include <temperament.h>
-#include <list.h>
+#include <threadpool.h>
 
 #include "codec_wav.h"
+#include "pcmbuf.h"
+#include "instrument.h"
+#include "wavetable.h"
+
+//Frames rendered at once, long waits are split in several blocks
+#define SAMPLER_BLOCK_SIZE CODEC_WAV_BLOCK_LENGTH
+
+//Range of the held voices index
+#define SAMPLER_CHANNELS 16
+#define SAMPLER_NOTES 128
+
+enum sampler_steal {
+	SAMPLER_STEAL_OLDEST,
+	SAMPLER_STEAL_QUIETEST,
+	SAMPLER_STEAL_SAME_NOTE
+};
+
+typedef enum sampler_steal SamplerSteal;
+
+//Bounds on the voices sounding at once
+struct sampler_limits {
+	int max_voices; //voices allocated
+	int polyphony; //voices sounding before stealing, 0 for max_voices
+	SamplerSteal steal;
+	float threshold; //amplitude ending a release, 0 to play it fully
+};
+
+typedef struct sampler_limits SamplerLimits;
+
+//Sound rendered after the last event
+#define SAMPLER_TAIL_USEC 1000000
+
+//Length of the time slices rendered in parallel by sampler_render
+#define SAMPLER_SEGMENT_SECONDS 5
+
+//Slice of the output rendered by a worker: the timeline before start is
+//replayed without rendering, it stops at end
+struct sampler_segment {
+	unsigned int start;
+	unsigned int end;
+	FILE *f;
+	char *data;
+	size_t size;
+	size_t length;
+	int ret;
+};
+
+typedef struct sampler_segment SamplerSegment;
 
 struct sampler {
 	PlayerEngineClassDef *class_def;
@@ -34,14 +82,36 @@ struct sampler {
 	unsigned int samplerate;
 	float gain;
 	bool autopan;
-	List *events;
 	CodecWav *codec_wav;
 	Temperament *temperament;
+	InstrumentOscillator oscillator;
+	Wavetable *wavetable;
+	Pcmbuf *pcmbuf;
+
+	SamplerLimits limits;
+
+	//Sounding voices in note on order, and the ones still held by
+	//channel and note. Both are sized by the pool.
+	struct sampler_pool *voice_pool;
+	struct sampler_event **voices;
+	int nvoices;
+	struct sampler_event *held[SAMPLER_CHANNELS][SAMPLER_NOTES];
+
+	//Voices are sharded over the threads, each shard mixing in its
+	//own block
+	int threads;
+	Threadpool *pool;
+	Pcmbuf **shards;
+
+	//Time sliced rendering, segment is only set on the worker copies
+	int render_jobs;
+	SamplerSegment *segment;
+	bool rendered;
 };
 
 typedef struct sampler Sampler;
 
-Sampler *sampler_new(float gain, bool autopan, CodecWav *codec_wav, Temperament *temperament);
+Sampler *sampler_new(float gain, bool autopan, InstrumentOscillator oscillator, SamplerLimits const *limits, int threads, int render_jobs, CodecWav *codec_wav, Temperament *temperament);
 void sampler_free(Sampler *this);
 
 #endif
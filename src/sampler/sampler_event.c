@@ -25,13 +25,17 @@
 
 #include "instrument.h"
 
-SamplerEvent *sampler_event_new(Sampler *sampler, unsigned int position, int channel, int note, int velocity, float gain, float pan)
+//Voices come from the sampler pool, they are initialised in place
+void sampler_event_init(SamplerEvent *this, Sampler *sampler, unsigned int position, int channel, int note, int velocity, float gain, float pan)
 {
-	SamplerEvent *this = malloc(sizeof(SamplerEvent));
 	this->sampler = sampler;
 
+	//Audibility threshold, relative to the voice level
+	float level = gain * (float) velocity / 127.0;
+	float silence = level > 0 ? sampler->limits.threshold / level : 0;
+
 	float fondamental = temperament_get_freq(sampler->temperament, note);
-	this->instrument = instrument_new(fondamental, velocity, &instrument_piano);
+	instrument_init(&this->instrument, fondamental, velocity, &instrument_piano, sampler->oscillator, sampler->wavetable, sampler->samplerate, silence);
 
 	this->note = note;
 	this->position = position;
@@ -42,13 +46,6 @@ SamplerEvent *sampler_event_new(Sampler *sampler, unsigned int position, int cha
 	this->terminated = false;
 	this->gain = gain;
 	this->pan = pan;
-	return this;
-}
-
-void sampler_event_free(SamplerEvent *this)
-{
-	instrument_free(this->instrument);
-	free(this);
 }
 
 void sampler_event_render(SamplerEvent *this, unsigned long position, Pcmbuf *pcmbuf)
@@ -56,26 +53,45 @@ void sampler_event_render(SamplerEvent *this, unsigned long position, Pcmbuf *pc
 	float duration = this->ending == true ? this->duration : -1;
 
 	for (unsigned int i = 0; i < pcmbuf->length; i++)  {
-		float t = (float) (position - this->position + i) / (float) this->sampler->samplerate;
+		unsigned int sample = position - this->position + i;
 
-		float value = instrument_compute(this->instrument, duration, t, &this->terminated);
+		float value = instrument_compute(&this->instrument, duration, sample, &this->terminated);
 
 		if (this->terminated == true) {
 			break;
 		}
 		value *= this->gain;
 
+		float *frame = pcmbuf_get_frame(pcmbuf, i);
 		if (this->pan >= 0 && pcmbuf->channels == 2) {
-			pcmbuf_inc(pcmbuf, i, 0, value * (1 - this->pan));
-			pcmbuf_inc(pcmbuf, i, 1, value * this->pan);
+			frame[0] += value * (1 - this->pan);
+			frame[1] += value * this->pan;
 		}
 		else {
-			int output_channel = this->channel % pcmbuf->channels;
-			pcmbuf_inc(pcmbuf, i, output_channel, value);
+			frame[this->channel % pcmbuf->channels] += value;
 		}
 	}
 }
 
+//Current amplitude of the voice, before panning
+float sampler_event_get_level(SamplerEvent *this, unsigned long position)
+{
+	float duration = this->ending == true ? this->duration : -1;
+	float t = (float) (position - this->position) / (float) this->sampler->samplerate;
+	float envelope = instrument_compute_envelope(&this->instrument, duration, t);
+	if (envelope < 0) {
+		return 0;
+	}
+	return envelope * this->gain * (float) this->velocity / 127.0;
+}
+
+//Check without rendering whether the voice is silent at position
+bool sampler_event_is_terminated(SamplerEvent *this, unsigned long position)
+{
+	float duration = this->ending == true ? this->duration : -1;
+	return instrument_is_terminated(&this->instrument, duration, position - this->position);
+}
+
 void sampler_event_set_end(SamplerEvent *this, unsigned long end)
 {
 	this->duration = (end - this->position) / (float) this->sampler->samplerate;
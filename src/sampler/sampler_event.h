@@ -27,7 +27,7 @@
 
 struct sampler_event {
 	Sampler *sampler;
-	Instrument *instrument;
+	Instrument instrument;
 	unsigned int position;
 	float duration;
 	float gain;
@@ -41,9 +41,10 @@ struct sampler_event {
 
 typedef struct sampler_event SamplerEvent;
 
-SamplerEvent *sampler_event_new(Sampler *sampler, unsigned int position, int channel, int note, int velocity, float gain, float pan);
-void sampler_event_free(SamplerEvent *this);
+void sampler_event_init(SamplerEvent *this, Sampler *sampler, unsigned int position, int channel, int note, int velocity, float gain, float pan);
 void sampler_event_render(SamplerEvent *this, unsigned long position, Pcmbuf *pcmbuf);
 void sampler_event_set_end(SamplerEvent *this, unsigned long end);
+bool sampler_event_is_terminated(SamplerEvent *this, unsigned long position);
+float sampler_event_get_level(SamplerEvent *this, unsigned long position);
 
 #endif
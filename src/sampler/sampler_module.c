@@ -19,6 +19,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include <common.h>
@@ -33,8 +34,16 @@ SamplerModule *sampler_module_new(void)
 	this->channels = 2;
 	this->gain = 0.2;
 	this->samplerate = 44100;
-	this->samplesize = 4;
+	this->format = SAMPLER_DEFAULT_FORMAT;
+	this->container = SAMPLER_DEFAULT_CONTAINER;
 	this->autopan = false;
+	this->oscillator = SAMPLER_DEFAULT_OSCILLATOR;
+	this->limits.max_voices = SAMPLER_DEFAULT_MAX_VOICES;
+	this->limits.polyphony = 0;
+	this->limits.steal = SAMPLER_DEFAULT_STEAL;
+	this->limits.threshold = 0;
+	this->threads = SAMPLER_DEFAULT_THREADS;
+	this->render_jobs = SAMPLER_DEFAULT_RENDER_JOBS;
 
 	this->codec_wav = NULL;
 	this->sampler = NULL;
@@ -58,8 +67,16 @@ static const struct option sampler_options[] = {
 	{ "channels", 1, NULL, 'c' },
 	{ "sample-rate", 1, NULL, 'r' },
 	{ "sample-bits", 1, NULL, 'S' },
+	{ "format", 1, NULL, 'F' },
 	{ "gain", 1, NULL, 'g' },
 	{ "autopan", 0, NULL, 'P' },
+	{ "oscillator", 1, NULL, 'O' },
+	{ "max-voices", 1, NULL, 'm' },
+	{ "polyphony", 1, NULL, 'y' },
+	{ "steal", 1, NULL, 'Y' },
+	{ "threshold", 1, NULL, 'A' },
+	{ "threads", 1, NULL, 'w' },
+	{ "render-jobs", 1, NULL, 'R' },
 	{ NULL, 0, NULL, 0}
 };
 
@@ -71,12 +88,22 @@ static struct option const *sampler_module_get_options(SamplerModule *this)
 static void sampler_module_usage(SamplerModule *this, char const *app)
 {
 
-	printf("   -o,  --output                     Set output filename\n");
+	printf("   -o,  --output                     Set output filename, - for stdout\n");
 	printf("   -c,  --channels                   Set output channels (default: %d)\n", SAMPLER_DEFAULT_CHANNELS);
 	printf("   -r,  --sample-rate                Set output sample rate (default: %d hz)\n", SAMPLER_DEFAULT_SAMPLE_RATE);
-	printf("   -S,  --sample-bits                Set output sample size (default: %d bits)\n", SAMPLER_DEFAULT_SAMPLE_SIZE * 8);
+	printf("   -S,  --sample-bits                Set output sample size: 8, 16, 24, 32, 32f (default: 32)\n");
+	printf("   -F,  --format                     Set output format: wav, raw (default: wav)\n");
 	printf("   -g,  --gain                       Set gain (default: %.0f%%)\n", SAMPLER_DEFAULT_GAIN * 100.0);
 	printf("   -P,  --autopan                    Pan right/left low/high notes\n");
+	printf("   -O,  --oscillator                 Set oscillator: sine, wavetable, phasor (default: wavetable)\n");
+	printf("   -m,  --max-voices                 Set the number of voices sounding at once (default: %d)\n", SAMPLER_DEFAULT_MAX_VOICES);
+	printf("   -y,  --polyphony                  Set the voices sounding before stealing (default: max voices)\n");
+	printf("   -Y,  --steal                      Set the voice stolen: oldest, quietest, same-note (default: oldest)\n");
+	printf("   -A,  --threshold                  End releases quieter than this many dB below full scale (default: off)\n");
+	printf("   -w,  --threads                    Set render threads (default: %d)\n", SAMPLER_DEFAULT_THREADS);
+	printf("   -R,  --render-jobs                Render time segments in parallel, voices are then\n");
+	printf("                                     not sharded and format 0 files are parsed\n");
+	printf("                                     whole instead of streamed (default: off)\n");
 }
 
 static int sampler_module_parse_arg(SamplerModule *this, char key, char const *optarg)
@@ -103,21 +130,121 @@ static int sampler_module_parse_arg(SamplerModule *this, char key, char const *o
 			this->samplerate = samplerate;
 			return 1;
 		}
-		case 'S': {
-			int bits = atoi(optarg);
-			if (bits != 8 && bits != 16 && bits != 32) {
-				print_error("Unexpected sample size: %d bits", bits);
+		case 'S':
+			if (strcmp(optarg, "8") == 0) {
+				this->format = PCMBUF_FORMAT_U8;
+			}
+			else if (strcmp(optarg, "16") == 0) {
+				this->format = PCMBUF_FORMAT_I16;
+			}
+			else if (strcmp(optarg, "24") == 0) {
+				this->format = PCMBUF_FORMAT_I24;
+			}
+			else if (strcmp(optarg, "32") == 0) {
+				this->format = PCMBUF_FORMAT_I32;
+			}
+			else if (strcmp(optarg, "32f") == 0) {
+				this->format = PCMBUF_FORMAT_F32;
+			}
+			else {
+				print_error("Unexpected sample size: %s bits", optarg);
+				return -1;
+			}
+			return 1;
+		case 'F':
+			if (strcmp(optarg, "wav") == 0) {
+				this->container = CODEC_WAV_CONTAINER_WAV;
+			}
+			else if (strcmp(optarg, "raw") == 0) {
+				this->container = CODEC_WAV_CONTAINER_RAW;
+			}
+			else {
+				print_error("Unexpected output format: %s", optarg);
 				return -1;
 			}
-			this->samplesize = bits / 8;
 			return 1;
-		}
 		case 'g':
 			this->gain = (float) atoi(optarg) / 100.0;
 			return 1;
 		case 'P':
 			this->autopan = true;
 			return 1;
+		case 'O':
+			if (strcmp(optarg, "sine") == 0) {
+				this->oscillator = INSTRUMENT_OSCILLATOR_SINE;
+			}
+			else if (strcmp(optarg, "wavetable") == 0) {
+				this->oscillator = INSTRUMENT_OSCILLATOR_WAVETABLE;
+			}
+			else if (strcmp(optarg, "phasor") == 0) {
+				this->oscillator = INSTRUMENT_OSCILLATOR_PHASOR;
+			}
+			else {
+				print_error("Unexpected oscillator: %s", optarg);
+				return -1;
+			}
+			return 1;
+		case 'm': {
+			int max_voices = atoi(optarg);
+			if (max_voices < 1) {
+				print_error("Unexpected max voices: %d", max_voices);
+				return -1;
+			}
+			this->limits.max_voices = max_voices;
+			return 1;
+		}
+		case 'y': {
+			int polyphony = atoi(optarg);
+			if (polyphony < 1) {
+				print_error("Unexpected polyphony: %d", polyphony);
+				return -1;
+			}
+			this->limits.polyphony = polyphony;
+			return 1;
+		}
+		case 'Y':
+			if (strcmp(optarg, "oldest") == 0) {
+				this->limits.steal = SAMPLER_STEAL_OLDEST;
+			}
+			else if (strcmp(optarg, "quietest") == 0) {
+				this->limits.steal = SAMPLER_STEAL_QUIETEST;
+			}
+			else if (strcmp(optarg, "same-note") == 0) {
+				this->limits.steal = SAMPLER_STEAL_SAME_NOTE;
+			}
+			else {
+				print_error("Unexpected steal policy: %s", optarg);
+				return -1;
+			}
+			return 1;
+		case 'A': {
+			char *end;
+			float db = fabsf(strtof(optarg, &end));
+			if (end == optarg || *end != '\0' || db == 0 || !isfinite(db)) {
+				print_error("Unexpected threshold: %s", optarg);
+				return -1;
+			}
+			this->limits.threshold = powf(10.0, -db / 20.0);
+			return 1;
+		}
+		case 'w': {
+			int threads = atoi(optarg);
+			if (threads < 1) {
+				print_error("Unexpected render threads: %d", threads);
+				return -1;
+			}
+			this->threads = threads;
+			return 1;
+		}
+		case 'R': {
+			int jobs = atoi(optarg);
+			if (jobs < 1) {
+				print_error("Unexpected render jobs: %d", jobs);
+				return -1;
+			}
+			this->render_jobs = jobs;
+			return 1;
+		}
 	}
 	return 0;
 }
@@ -128,11 +255,11 @@ static PlayerEngine *sampler_module_get_engine(SamplerModule *this, Temperament
 		return NULL;
 	}
 
-	this->codec_wav = codec_wav_new(this->samplesize, this->channels, this->samplerate, this->output);
+	this->codec_wav = codec_wav_new(this->format, this->container, this->channels, this->samplerate, this->output);
 	if (this->codec_wav == NULL) {
 		return NULL;
 	}
-	this->sampler = sampler_new(this->gain, this->autopan, this->codec_wav, temperament);
+	this->sampler = sampler_new(this->gain, this->autopan, this->oscillator, &this->limits, this->threads, this->render_jobs, this->codec_wav, temperament);
 	return (PlayerEngine *) this->sampler;
 }
 
@@ -25,8 +25,14 @@
 
 #define SAMPLER_DEFAULT_CHANNELS 2
 #define SAMPLER_DEFAULT_SAMPLE_RATE 44100
-#define SAMPLER_DEFAULT_SAMPLE_SIZE 4
+#define SAMPLER_DEFAULT_FORMAT PCMBUF_FORMAT_I32
+#define SAMPLER_DEFAULT_CONTAINER CODEC_WAV_CONTAINER_WAV
 #define SAMPLER_DEFAULT_GAIN 0.2
+#define SAMPLER_DEFAULT_OSCILLATOR INSTRUMENT_OSCILLATOR_WAVETABLE
+#define SAMPLER_DEFAULT_MAX_VOICES 1024
+#define SAMPLER_DEFAULT_STEAL SAMPLER_STEAL_OLDEST
+#define SAMPLER_DEFAULT_THREADS 1
+#define SAMPLER_DEFAULT_RENDER_JOBS 0
 
 struct sampler_module {
 	ModuleClassDef *class_def;
@@ -36,8 +42,13 @@ struct sampler_module {
 	int channels;
 	float gain;
 	int samplerate;
-	int samplesize;
+	PcmbufFormat format;
+	CodecWavContainer container;
 	bool autopan;
+	InstrumentOscillator oscillator;
+	SamplerLimits limits;
+	int threads;
+	int render_jobs;
 	CodecWav *codec_wav;
 	Sampler *sampler;
 };
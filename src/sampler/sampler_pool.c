@@ -0,0 +1,49 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sampler_pool.h"
+
+#include <stdlib.h>
+
+SamplerPool *sampler_pool_new(int capacity)
+{
+	SamplerPool *this = malloc(sizeof(SamplerPool));
+	if (this == NULL) {
+		return NULL;
+	}
+	this->events = malloc(capacity * sizeof(SamplerEvent));
+	this->free_list = malloc(capacity * sizeof(SamplerEvent *));
+	if (this->events == NULL || this->free_list == NULL) {
+		sampler_pool_free(this);
+		return NULL;
+	}
+
+	//The first voices are handed out first
+	for (int i = 0; i < capacity; i++) {
+		this->free_list[i] = &this->events[capacity - 1 - i];
+	}
+	this->capacity = capacity;
+	this->available = capacity;
+	return this;
+}
+
+void sampler_pool_free(SamplerPool *this)
+{
+	free(this->free_list);
+	free(this->events);
+	free(this);
+}
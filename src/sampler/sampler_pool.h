@@ -0,0 +1,51 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SAMPLER_POOL_H
+#define SAMPLER_POOL_H
+
+#include "sampler_event.h"
+
+//Fixed set of voices allocated once, released voices are kept on a free
+//list for the next note on
+struct sampler_pool {
+	SamplerEvent *events;
+	SamplerEvent **free_list;
+	int capacity;
+	int available;
+};
+
+typedef struct sampler_pool SamplerPool;
+
+SamplerPool *sampler_pool_new(int capacity);
+void sampler_pool_free(SamplerPool *this);
+
+//Returns NULL once all the voices are in use
+inline static SamplerEvent *sampler_pool_get(SamplerPool *this)
+{
+	if (this->available == 0) {
+		return NULL;
+	}
+	return this->free_list[--this->available];
+}
+
+inline static void sampler_pool_put(SamplerPool *this, SamplerEvent *event)
+{
+	this->free_list[this->available++] = event;
+}
+
+#endif
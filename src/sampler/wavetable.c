@@ -0,0 +1,75 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wavetable.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+static void wavetable_fill(float *table, float const *spectrum, int partials)
+{
+	for (int i = 0; i < WAVETABLE_SIZE; i++) {
+		double phase = 2.0 * M_PI * i / WAVETABLE_SIZE;
+		double value = 0;
+		for (int j = 0; j < partials; j++) {
+			if (spectrum[j] > 0) {
+				value += spectrum[j] * sin(phase * (j + 1));
+			}
+		}
+		table[i] = value;
+	}
+	//Guard point for the interpolation
+	table[WAVETABLE_SIZE] = table[0];
+}
+
+Wavetable *wavetable_new(float const *spectrum, int partials, unsigned int samplerate)
+{
+	Wavetable *this = malloc(sizeof(Wavetable));
+	if (this == NULL) {
+		return NULL;
+	}
+
+	float nyquist = samplerate / 2.0;
+	for (int i = 0; i < WAVETABLE_OCTAVES; i++) {
+		//Highest fundamental of the octave
+		float freq = WAVETABLE_BASE_FREQ * (float) (2 << i);
+		int n = 0;
+		while (n < partials && (n + 1) * freq < nyquist) {
+			n++;
+		}
+		//Keep at least the fundamental
+		wavetable_fill(this->tables[i], spectrum, n > 0 ? n : 1);
+	}
+	return this;
+}
+
+void wavetable_free(Wavetable *this)
+{
+	free(this);
+}
+
+float const *wavetable_get_table(Wavetable *this, float freq)
+{
+	int octave = floorf(log2f(freq / WAVETABLE_BASE_FREQ));
+	if (octave < 0) {
+		octave = 0;
+	}
+	if (octave >= WAVETABLE_OCTAVES) {
+		octave = WAVETABLE_OCTAVES - 1;
+	}
+	return this->tables[octave];
+}
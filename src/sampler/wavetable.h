@@ -0,0 +1,48 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+#define WAVETABLE_SIZE 2048
+#define WAVETABLE_OCTAVES 11
+#define WAVETABLE_BASE_FREQ 8.1758 //MIDI note 0
+
+//One period of an additive spectrum, per octave of fundamental: the
+//partials above the Nyquist frequency of an octave are left out
+struct wavetable {
+	float tables[WAVETABLE_OCTAVES][WAVETABLE_SIZE + 1];
+};
+
+typedef struct wavetable Wavetable;
+
+Wavetable *wavetable_new(float const *spectrum, int partials, unsigned int samplerate);
+void wavetable_free(Wavetable *this);
+float const *wavetable_get_table(Wavetable *this, float freq);
+
+//Linear interpolation, phase in [0, 1]. A phase rounded up to 1 wraps
+//to the start of the table instead of reading past its guard point.
+inline static float wavetable_read(float const *table, float phase)
+{
+	float x = phase * WAVETABLE_SIZE;
+	int i = (int) x;
+	float frac = x - i;
+	i &= WAVETABLE_SIZE - 1;
+	return table[i] + (table[i + 1] - table[i]) * frac;
+}
+
+#endif
@@ -19,6 +19,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "common.h"
 
@@ -32,93 +36,88 @@ Streambuf *streambuf_new(void)
 	this->data = NULL;
 	this->read_offset = 0;
 	this->size = 0;
+	this->mapped = false;
 	return this;
 }
 
 void streambuf_free(Streambuf *this)
 {
-	if (this->data != NULL) {
-		free(this->data);
+	if (this->mapped == true) {
+		munmap((void *) this->data, this->size);
+	}
+	else if (this->data != NULL) {
+		free((void *) this->data);
 	}
 	free(this);
 }
 
-int streambuf_open(Streambuf *this, char const *filename)
-{
-	int ret = -1;
-
-	FILE *f = fopen(filename, "r");
-	if (f == NULL) {
-		print_error("Could not open inpuf file: '%s'", filename);
-		return -1;
-	}
-
-	//Get file size
-	if (fseek(f, 0, SEEK_END) != 0) {
-		goto exit;
-	}
-
-	size_t size = ftell(f);
+#define STREAMBUF_READ_CHUNK 65536
 
-	if (fseek(f, 0, SEEK_SET) != 0) {
-		goto exit;
-	}
+//Read the whole stream into memory, used for pipes and other files
+//that can not be mapped
+static int streambuf_read_fd(Streambuf *this, int fd)
+{
+	uint8_t *data = NULL;
+	size_t capacity = 0;
+	size_t size = 0;
+
+	for (;;) {
+		if (size == capacity) {
+			capacity += capacity > 0 ? capacity : STREAMBUF_READ_CHUNK;
+			uint8_t *tmp = realloc(data, capacity);
+			if (tmp == NULL) {
+				free(data);
+				return -1;
+			}
+			data = tmp;
+		}
 
-	//Read file content
-	this->data = malloc(size);
-	if (this->data == NULL) {
-		goto exit;
+		ssize_t n = read(fd, data + size, capacity - size);
+		if (n < 0) {
+			free(data);
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		size += n;
 	}
 
+	this->data = data;
 	this->size = size;
 	this->read_offset = 0;
-
-	if (fread(this->data, 1, this->size, f) != this->size) {
-		goto exit;
-	}
-
-	ret = 0;
-
-exit:
-	fclose(f);
-
-	return ret;
+	this->mapped = false;
+	return 0;
 }
 
-int streambuf_read_u8(Streambuf *this, uint8_t *value)
+int streambuf_open(Streambuf *this, char const *filename)
 {
-	if (this->read_offset >= this->size) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		print_error("Could not open inpuf file: '%s'", filename);
 		return -1;
 	}
 
-	*value = this->data[this->read_offset];
-	this->read_offset++;
-	return 0;
-}
-
-int streambuf_read_u16(Streambuf *this, uint16_t *value)
-{
-	*value = 0;
-	uint8_t u8;
-	for (int i = 0; i < 2; i++) {
-		if (streambuf_read_u8(this, &u8) != 0) {
-			return -1;
+	//Regular files are read straight from the page cache
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+			this->data = data;
+			this->size = st.st_size;
+			this->read_offset = 0;
+			this->mapped = true;
+			close(fd);
+			return 0;
 		}
-		*value = (*value << 8) | u8;
 	}
-	return 0;
-}
 
-int streambuf_read_u32(Streambuf *this, uint32_t *value)
-{
-	*value = 0;
-	uint8_t u8;
-	for (int i = 0; i < 4; i++) {
-		if (streambuf_read_u8(this, &u8) != 0) {
-			return -1;
-		}
-		*value = (*value << 8) | u8;
+	int ret = streambuf_read_fd(this, fd);
+	if (ret != 0) {
+		print_error("Could not read input file: '%s'", filename);
 	}
-	return 0;
+	close(fd);
+	return ret;
 }
-
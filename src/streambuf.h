@@ -20,11 +20,13 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 struct streambuf {
-	uint8_t *data;
+	uint8_t const *data;
 	size_t read_offset;
 	size_t size;
+	bool mapped;
 };
 
 typedef struct streambuf Streambuf;
@@ -32,8 +34,111 @@ typedef struct streambuf Streambuf;
 Streambuf *streambuf_new(void);
 void streambuf_free(Streambuf *this);
 int streambuf_open(Streambuf *this, char const *filename);
-int streambuf_read_u8(Streambuf *this, uint8_t *value);
-int streambuf_read_u16(Streambuf *this, uint16_t *value);
-int streambuf_read_u32(Streambuf *this, uint32_t *value);
+
+//--- Inline readers: one bounds check per record, then direct loads
+
+inline static size_t streambuf_available(Streambuf const *this)
+{
+	return this->size - this->read_offset;
+}
+
+inline static uint8_t const *streambuf_cursor(Streambuf const *this)
+{
+	return this->data + this->read_offset;
+}
+
+inline static int streambuf_read_u8(Streambuf *this, uint8_t *value)
+{
+	if (this->read_offset >= this->size) {
+		return -1;
+	}
+
+	*value = this->data[this->read_offset];
+	this->read_offset++;
+	return 0;
+}
+
+inline static int streambuf_read_u16(Streambuf *this, uint16_t *value)
+{
+	if (streambuf_available(this) < 2) {
+		return -1;
+	}
+
+	uint8_t const *p = streambuf_cursor(this);
+	*value = ((uint16_t) p[0] << 8) | p[1];
+	this->read_offset += 2;
+	return 0;
+}
+
+inline static int streambuf_read_u32(Streambuf *this, uint32_t *value)
+{
+	if (streambuf_available(this) < 4) {
+		return -1;
+	}
+
+	uint8_t const *p = streambuf_cursor(this);
+	*value = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+	this->read_offset += 4;
+	return 0;
+}
+
+//Zero-copy view of the next bytes, valid as long as the Streambuf
+inline static int streambuf_read_view(Streambuf *this, size_t length, uint8_t const **data)
+{
+	if (streambuf_available(this) < length) {
+		return -1;
+	}
+
+	*data = streambuf_cursor(this);
+	this->read_offset += length;
+	return 0;
+}
+
+inline static int streambuf_skip(Streambuf *this, size_t length)
+{
+	if (streambuf_available(this) < length) {
+		return -1;
+	}
+
+	this->read_offset += length;
+	return 0;
+}
+
+//Variable length quantity, at most 4 bytes (28 bits)
+inline static int streambuf_read_vlq(Streambuf *this, uint32_t *value)
+{
+	uint8_t const *p = streambuf_cursor(this);
+
+	if (streambuf_available(this) >= 4) {
+		uint32_t w = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+
+		//The first byte without continuation bit ends the quantity
+		uint32_t stop = ~w & 0x80808080;
+		if (stop == 0) {
+			return -1;
+		}
+		int length = __builtin_clz(stop) / 8 + 1;
+
+		uint32_t x = (w >> (8 * (4 - length))) & 0x7f7f7f7f;
+		*value = (x & 0x7f) |
+			((x >> 1) & 0x3f80) |
+			((x >> 2) & 0x1fc000) |
+			((x >> 3) & 0xfe00000);
+		this->read_offset += length;
+		return 0;
+	}
+
+	//Slow path near the end of the stream
+	uint32_t v = 0;
+	for (size_t i = 0; i < streambuf_available(this) && i < 4; i++) {
+		v = (v << 7) | (p[i] & 0x7f);
+		if ((p[i] & 0x80) == 0) {
+			*value = v;
+			this->read_offset += i + 1;
+			return 0;
+		}
+	}
+	return -1;
+}
 
 #endif
@@ -30,11 +30,23 @@ static TemperamentClassDef *temperament_classes[] = {
 	&temperament_dom_bedos_class_def
 };
 
+//Frequencies of MIDI notes are computed once, when the pitch is set
+static void temperament_build_freqs(Temperament *this)
+{
+	for (int i = 0; i < TEMPERAMENT_NOTES; i++) {
+		this->freqs[i] = this->class_def->get_freq(this, i);
+	}
+}
+
 Temperament *temperament_new(char const *name)
 {
 	for (int i = 0; i < ARRAY_SIZE(temperament_classes); i++) {
 		if (strcmp(name, temperament_classes[i]->id) == 0) {
-			return temperament_classes[i]->new();
+			Temperament *this = temperament_classes[i]->new();
+			if (this != NULL) {
+				temperament_build_freqs(this);
+			}
+			return this;
 		}
 	}
 	return NULL;
@@ -53,12 +65,20 @@ void temperament_free(Temperament *this)
 
 float temperament_get_freq(Temperament *this, int note)
 {
+	if (note >= 0 && note < TEMPERAMENT_NOTES) {
+		return this->freqs[note];
+	}
+	//Out of MIDI range, after transposition
 	return this->class_def->get_freq(this, note);
 }
 
 int temperament_set_pitch(Temperament *this, float freq)
 {
-	return this->class_def->set_pitch(this, freq);
+	int ret = this->class_def->set_pitch(this, freq);
+	if (ret == 0) {
+		temperament_build_freqs(this);
+	}
+	return ret;
 }
 
 void temperaments_list(char const *prefix)
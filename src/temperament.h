@@ -18,6 +18,8 @@
 #ifndef TEMPERAMENT_H
 #define TEMPERAMENT_H
 
+#define TEMPERAMENT_NOTES 128
+
 struct temperament;
 typedef struct temperament Temperament;
 
@@ -41,6 +43,7 @@ typedef struct temperament_class_def TemperamentClassDef;
 
 struct temperament {
 	TemperamentClassDef *class_def;
+	float freqs[TEMPERAMENT_NOTES];
 	//... 
 	//... private temperament data
 	//...
@@ -22,6 +22,7 @@
 
 struct temperament_dom_bedos {
 	TemperamentClassDef *class_def;
+	float freqs[TEMPERAMENT_NOTES];
 
 //--- private temperament data
 	float freq_c3;
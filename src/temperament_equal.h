@@ -22,6 +22,7 @@
 
 struct temperament_equal {
 	TemperamentClassDef *class_def;
+	float freqs[TEMPERAMENT_NOTES];
 
 //--- private temperament data
 	float freq_a3;
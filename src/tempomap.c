@@ -0,0 +1,183 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tempomap.h"
+
+#include <stdlib.h>
+
+#include "common.h"
+
+Tempomap *tempomap_new(void)
+{
+	Tempomap *this = malloc(sizeof(Tempomap));
+	if (this == NULL) {
+		return NULL;
+	}
+
+	this->tempos = NULL;
+	this->count = 0;
+	this->capacity = 0;
+	this->division = 0;
+	this->ticks_per_unit = 0;
+	pthread_mutex_init(&this->lock, NULL);
+	return this;
+}
+
+void tempomap_free(Tempomap *this)
+{
+	pthread_mutex_destroy(&this->lock);
+	free(this->tempos);
+	free(this);
+}
+
+void tempomap_set_division(Tempomap *this, int division)
+{
+	this->division = division;
+}
+
+//Tracks may be parsed concurrently
+int tempomap_add(Tempomap *this, int track, uint32_t tick, uint32_t tempo)
+{
+	int ret = -1;
+	pthread_mutex_lock(&this->lock);
+
+	if (this->count >= this->capacity) {
+		int capacity = this->capacity > 0 ? this->capacity * 2 : 16;
+		struct tempo *tempos = realloc(this->tempos, capacity * sizeof(struct tempo));
+		if (tempos == NULL) {
+			goto exit;
+		}
+		this->tempos = tempos;
+		this->capacity = capacity;
+	}
+
+	struct tempo *t = &this->tempos[this->count++];
+	t->track = track;
+	t->tick = tick;
+	t->tempo = tempo;
+	t->time = 0;
+	ret = 0;
+
+exit:
+	pthread_mutex_unlock(&this->lock);
+	return ret;
+}
+
+static int tempo_cmp(struct tempo const *a, struct tempo const *b)
+{
+	if (a->tick != b->tick) {
+		return a->tick > b->tick ? 1 : -1;
+	}
+	return a->track - b->track;
+}
+
+static int64_t tempomap_ticks_to_time(Tempomap *this, struct tempo const *from, uint32_t tick)
+{
+	return from->time + (int64_t) (tick - from->tick) * from->tempo / this->ticks_per_unit;
+}
+
+//SMPTE division: time is a fixed number of ticks per frame, Set Tempo
+//events do not apply. It is handled as a single tempo segment.
+static int tempomap_build_smpte(Tempomap *this)
+{
+	int fps = -(int8_t) (this->division >> 8);
+	int ticks_per_frame = this->division & 0xff;
+
+	uint32_t usec = 1000000;
+	switch (fps) {
+	case 24:
+	case 25:
+	case 30:
+		this->ticks_per_unit = (int64_t) fps * ticks_per_frame;
+		break;
+	case 29:
+		//29.97 fps drop frame: 30000 frames every 1001 seconds
+		usec = 1001000000;
+		this->ticks_per_unit = (int64_t) 30000 * ticks_per_frame;
+		break;
+	default:
+		print_error("Unexpected SMPTE format: %d fps", fps);
+		return -1;
+	}
+	if (ticks_per_frame == 0) {
+		print_error("Unexpected division");
+		return -1;
+	}
+
+	this->count = 0;
+	if (tempomap_add(this, 0, 0, usec) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+//Order tempo changes by tick and compute the time at which each one
+//starts. Must be called once all the tracks are parsed.
+int tempomap_build(Tempomap *this)
+{
+	if (this->division & 0x8000) {
+		return tempomap_build_smpte(this);
+	}
+	if (this->division == 0) {
+		print_error("Unexpected division");
+		return -1;
+	}
+	this->ticks_per_unit = this->division;
+
+	//Tracks append their tempo changes in any order: a stable insertion
+	//sort on (tick, track) keeps the file order for simultaneous changes
+	for (int i = 1; i < this->count; i++) {
+		struct tempo t = this->tempos[i];
+		int j = i;
+		while (j > 0 && tempo_cmp(&this->tempos[j - 1], &t) > 0) {
+			this->tempos[j] = this->tempos[j - 1];
+			j--;
+		}
+		this->tempos[j] = t;
+	}
+
+	//Default tempo until the first Set Tempo event
+	if (this->count == 0 || this->tempos[0].tick != 0) {
+		if (tempomap_add(this, 0, 0, TEMPOMAP_DEFAULT_TEMPO) != 0) {
+			return -1;
+		}
+		struct tempo t = this->tempos[this->count - 1];
+		for (int i = this->count - 1; i > 0; i--) {
+			this->tempos[i] = this->tempos[i - 1];
+		}
+		this->tempos[0] = t;
+	}
+
+	this->tempos[0].time = 0;
+	for (int i = 1; i < this->count; i++) {
+		this->tempos[i].time = tempomap_ticks_to_time(this, &this->tempos[i - 1], this->tempos[i].tick);
+	}
+	return 0;
+}
+
+//Set the time of tick-ordered events in a single pass. Each time is
+//computed from the absolute tick so rounding errors do not accumulate.
+void tempomap_convert(Tempomap *this, Event *events, size_t count)
+{
+	int n = 0;
+	for (size_t i = 0; i < count; i++) {
+		while (n + 1 < this->count && this->tempos[n + 1].tick <= events[i].tick) {
+			n++;
+		}
+		events[i].time = tempomap_ticks_to_time(this, &this->tempos[n], events[i].tick);
+	}
+}
@@ -0,0 +1,55 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPOMAP_H
+#define TEMPOMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "eventbuf.h"
+
+#define TEMPOMAP_DEFAULT_TEMPO 697674
+
+struct tempo {
+	int track;
+	uint32_t tick;
+	uint32_t tempo; //microseconds per quarter note (per second with SMPTE)
+	int64_t time;   //microseconds at tick
+};
+
+//Set Tempo events of all tracks, in absolute ticks
+struct tempomap {
+	struct tempo *tempos;
+	int count;
+	int capacity;
+	int division;
+	int64_t ticks_per_unit;
+	pthread_mutex_t lock;
+};
+
+typedef struct tempomap Tempomap;
+
+Tempomap *tempomap_new(void);
+void tempomap_free(Tempomap *this);
+void tempomap_set_division(Tempomap *this, int division);
+int tempomap_add(Tempomap *this, int track, uint32_t tick, uint32_t tempo);
+int tempomap_build(Tempomap *this);
+void tempomap_convert(Tempomap *this, Event *events, size_t count);
+
+#endif
@@ -0,0 +1,149 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threadpool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common.h"
+
+//Run tasks until there is none left, called with the lock held
+static void threadpool_work(Threadpool *this)
+{
+	while (this->next < this->count) {
+		int index = this->next++;
+		ThreadpoolTask task = this->task;
+		void *ctx = this->ctx;
+
+		pthread_mutex_unlock(&this->lock);
+		task(ctx, index);
+		pthread_mutex_lock(&this->lock);
+	}
+}
+
+static void *threadpool_worker(void *arg)
+{
+	Threadpool *this = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&this->lock);
+	for (;;) {
+		while (this->stop == false && this->generation == generation) {
+			pthread_cond_wait(&this->start, &this->lock);
+		}
+		if (this->stop == true) {
+			break;
+		}
+		generation = this->generation;
+
+		this->running++;
+		threadpool_work(this);
+		this->running--;
+		if (this->running == 0) {
+			pthread_cond_signal(&this->done);
+		}
+	}
+	pthread_mutex_unlock(&this->lock);
+	return NULL;
+}
+
+Threadpool *threadpool_new(int jobs)
+{
+	Threadpool *this = malloc(sizeof(Threadpool));
+	if (this == NULL) {
+		return NULL;
+	}
+
+	this->nthreads = 0;
+	this->task = NULL;
+	this->ctx = NULL;
+	this->next = 0;
+	this->count = 0;
+	this->running = 0;
+	this->generation = 0;
+	this->stop = false;
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->start, NULL);
+	pthread_cond_init(&this->done, NULL);
+
+	int nthreads = jobs > 1 ? jobs - 1 : 0;
+	this->threads = malloc(nthreads * sizeof(pthread_t));
+	if (this->threads == NULL && nthreads > 0) {
+		threadpool_free(this);
+		return NULL;
+	}
+
+	for (int i = 0; i < nthreads; i++) {
+		if (pthread_create(&this->threads[i], NULL, threadpool_worker, this) != 0) {
+			print_error("Could not create thread");
+			break;
+		}
+		this->nthreads++;
+	}
+	return this;
+}
+
+void threadpool_free(Threadpool *this)
+{
+	pthread_mutex_lock(&this->lock);
+	this->stop = true;
+	pthread_cond_broadcast(&this->start);
+	pthread_mutex_unlock(&this->lock);
+
+	for (int i = 0; i < this->nthreads; i++) {
+		pthread_join(this->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&this->done);
+	pthread_cond_destroy(&this->start);
+	pthread_mutex_destroy(&this->lock);
+	free(this->threads);
+	free(this);
+}
+
+//Run task(ctx, 0) ... task(ctx, count - 1) and wait for all of them
+void threadpool_run(Threadpool *this, ThreadpoolTask task, void *ctx, int count)
+{
+	pthread_mutex_lock(&this->lock);
+	this->task = task;
+	this->ctx = ctx;
+	this->next = 0;
+	this->count = count;
+	this->generation++;
+	pthread_cond_broadcast(&this->start);
+
+	this->running++;
+	threadpool_work(this);
+	this->running--;
+
+	while (this->running > 0) {
+		pthread_cond_wait(&this->done, &this->lock);
+	}
+	pthread_mutex_unlock(&this->lock);
+}
+
+int threadpool_get_jobs(Threadpool *this)
+{
+	return this->nthreads + 1;
+}
+
+int threadpool_get_online_cpus(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? cpus : 1;
+}
@@ -0,0 +1,52 @@
+/* 
+ * This file is part of naive-midi-player.
+ * Copyright (c) 2024 VION Nicolas.
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*ThreadpoolTask)(void *ctx, int index);
+
+//Persistent worker threads running indexed tasks. The calling thread
+//takes part in the work, so a pool of n jobs has n - 1 workers.
+struct threadpool {
+	pthread_t *threads;
+	int nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	ThreadpoolTask task;
+	void *ctx;
+	int next;
+	int count;
+	int running;
+	unsigned int generation;
+	bool stop;
+};
+
+typedef struct threadpool Threadpool;
+
+Threadpool *threadpool_new(int jobs);
+void threadpool_free(Threadpool *this);
+void threadpool_run(Threadpool *this, ThreadpoolTask task, void *ctx, int count);
+int threadpool_get_jobs(Threadpool *this);
+
+int threadpool_get_online_cpus(void);
+
+#endif